@@ -19,12 +19,27 @@
     3. This notice may not be removed or altered from any source distribution.
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE     // O_DIRECT
+#endif
+
 #include "miniwav.h"
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 // Misc.
@@ -34,13 +49,28 @@ static const uint8_t RIFF_HEADER[4] = { 0x52, 0x49, 0x46, 0x46 };
 static const uint8_t WAVE_HEADER[4] = { 0x57, 0x41, 0x56, 0x45 };
 static const uint8_t FMT__HEADER[4] = { 0x66, 0x6D, 0x74, 0x20 };
 static const uint8_t DATA_HEADER[4] = { 0x64, 0x61, 0x74, 0x61 };
+static const uint8_t JUNK_HEADER[4] = { 0x4A, 0x55, 0x4E, 0x4B };
+
+// KSDATAFORMAT_SUBTYPE_*; the first two bytes hold the format tag
+static const uint8_t SUBFORMAT_GUID[16] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+    0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+};
+
+// samples converted per fread/fwrite call
+#define BLOCK_SAMPLES 4096
 
 static double *buffer_new(size_t length);
 static void buffer_delete(double *buffer);
 static int wavdata_is_bad_data(const wavdata_t *wave);
 static int wavdata_is_unsupported(const wavdata_t *wave);
+static int wavdata_is_extensible(const wavdata_t *wave);
+static unsigned channelmask_count(unsigned mask);
+static unsigned wavdata_get_mask(const wavdata_t *wave);
+static void wavdata_set_mask(wavdata_t *wave, unsigned mask);
 static wavtype_t wavtype_create(int fmtid, int bits);
 static int wavtype_get_bits(wavtype_t type);
+static int wavtype_is_native(wavtype_t type);
 
 static double *buffer_new(size_t length)
 {
@@ -57,7 +87,8 @@ static int wavdata_is_bad_data(const wavdata_t *wave)
     return (
         wave->size <= 0 ||
         wave->data == NULL ||
-        wave->type == TYPE_UNKNOWN
+        wave->type == TYPE_UNKNOWN ||
+        (wavdata_get_mask(wave) != 0 && channelmask_count(wavdata_get_mask(wave)) != wave->channels)
     );
 }
 
@@ -68,6 +99,40 @@ static int wavdata_is_unsupported(const wavdata_t *wave)
     );
 }
 
+// WAVE_FORMAT_EXTENSIBLE is only written when plain PCM/float can't
+// describe the layout
+static int wavdata_is_extensible(const wavdata_t *wave)
+{
+    return (
+        wave->channels > 2 ||
+        wavdata_get_mask(wave) != 0
+    );
+}
+
+// number of speaker positions named by a WAVE_FORMAT_EXTENSIBLE mask
+static unsigned channelmask_count(unsigned mask)
+{
+    unsigned n = 0;
+    for (; mask != 0; mask &= mask - 1) { n++; }
+    return n;
+}
+
+// channelmask only counts when channelmask_tag matches it, which only
+// wav_set_channelmask() and the library itself arrange: a struct filled
+// field by field, with garbage in both, doesn't get a speaker layout
+#define CHANNELMASK_TAG 0x6D61736Bu
+
+static unsigned wavdata_get_mask(const wavdata_t *wave)
+{
+    return (wave->channelmask_tag == (wave->channelmask ^ CHANNELMASK_TAG)) ? wave->channelmask : 0;
+}
+
+static void wavdata_set_mask(wavdata_t *wave, unsigned mask)
+{
+    wave->channelmask = mask;
+    wave->channelmask_tag = mask ^ CHANNELMASK_TAG;
+}
+
 static wavtype_t wavtype_create(int fmtid, int bits)
 {
     switch (fmtid) {
@@ -81,8 +146,9 @@ static wavtype_t wavtype_create(int fmtid, int bits)
         break;
 
     case 0x03:
-        if (bits == 32) {
-            return TYPE_FLOAT;
+        switch (bits) {
+        case 32: return TYPE_FLOAT;
+        case 64: return TYPE_DOUBLE;
         }
         break;
 
@@ -101,11 +167,91 @@ static int wavtype_get_bits(wavtype_t type)
     case TYPE_INT24: return 24;
     case TYPE_INT32: return 32;
     case TYPE_FLOAT: return 32;
+    case TYPE_DOUBLE: return 64;
     default:         return -1;
     }
     return -1;
 }
 
+// samples are stored exactly as wavdata_t.data holds them
+static int wavtype_is_native(wavtype_t type)
+{
+    const uint16_t one = 1;
+    return type == TYPE_DOUBLE && *(const uint8_t *)&one == 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stats
+///////////////////////////////////////////////////////////////////////////////
+
+static wavstats_callback_t stats_callback = NULL;
+static void *stats_callback_user = NULL;
+
+static wavstats_t *stats_begin(wavstats_t *stats, wavstats_t *local);
+static void stats_end(wavstats_t *stats, const char *func, waverror_t err, unsigned long long start);
+static unsigned long long stats_clock(const wavstats_t *stats);
+static void stats_io(wavstats_t *stats, unsigned long long start);
+static void stats_convert(wavstats_t *stats, unsigned long long start);
+
+void wav_set_stats_callback(wavstats_callback_t callback, void *user)
+{
+    stats_callback = callback;
+    stats_callback_user = user;
+}
+
+// returns NULL when nobody is listening, so that the hot paths can skip
+// every measurement
+static wavstats_t *stats_begin(wavstats_t *stats, wavstats_t *local)
+{
+    if (stats == NULL) {
+        if (stats_callback == NULL) { return NULL; }
+        stats = local;
+    }
+    memset(stats, 0, sizeof(*stats));
+    return stats;
+}
+
+static void stats_end(wavstats_t *stats, const char *func, waverror_t err, unsigned long long start)
+{
+    unsigned long long total;
+    if (stats == NULL) { return; }
+
+    // whatever is not I/O or conversion is spent on parsing
+    total = stats_clock(stats) - start;
+    if (total > stats->ns_io + stats->ns_convert) {
+        stats->ns_parse = total - stats->ns_io - stats->ns_convert;
+    }
+
+    if (stats_callback != NULL) {
+        stats_callback(func, err, stats, stats_callback_user);
+    }
+}
+
+static unsigned long long stats_clock(const wavstats_t *stats)
+{
+    if (stats == NULL) { return 0; }
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+    return (unsigned long long)clock() * (1000000000ULL / CLOCKS_PER_SEC);
+#endif
+}
+
+static void stats_io(wavstats_t *stats, unsigned long long start)
+{
+    if (stats == NULL) { return; }
+    stats->ns_io += stats_clock(stats) - start;
+    stats->io_calls++;
+}
+
+static void stats_convert(wavstats_t *stats, unsigned long long start)
+{
+    if (stats == NULL) { return; }
+    stats->ns_convert += stats_clock(stats) - start;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Create and Destroy
 ///////////////////////////////////////////////////////////////////////////////
@@ -117,6 +263,7 @@ waverror_t wav_create(wavdata_t *wave, unsigned samplerate, unsigned ch, size_t
     wave->size = frames * ch;
     wave->data = buffer_new(wave->size);
     wave->type = TYPE_INT16;
+    wavdata_set_mask(wave, 0);
     if (wavdata_is_bad_data(wave)) return ERROR_BAD_DATA;
     if (wavdata_is_unsupported(wave)) return ERROR_UNSUPPORTED;
     return ERROR_OK;
@@ -128,57 +275,345 @@ void wav_destroy(wavdata_t *wave)
     wave->channels = 0;
     wave->size = 0;
     buffer_delete(wave->data); wave->data = NULL;
+    wave->type = TYPE_UNKNOWN;
+    wavdata_set_mask(wave, 0);
+}
+
+// mask must be 0 or name exactly wave->channels speaker positions
+waverror_t wav_set_channelmask(wavdata_t *wave, unsigned mask)
+{
+    assert(wave != NULL);
+    if (mask != 0 && channelmask_count(mask) != wave->channels) { return ERROR_BAD_DATA; }
+    wavdata_set_mask(wave, mask);
+    return ERROR_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Resample
+///////////////////////////////////////////////////////////////////////////////
+
+#define RESAMPLER_CHUNK    1024   // frames filtered per pass
+#define RESAMPLER_PASSBAND 0.91   // passband edge relative to the lower Nyquist
+#define RESAMPLER_STOPBAND 1.0    // stopband edge relative to the lower Nyquist
+#define RESAMPLER_ATTEN    90.0   // stopband attenuation in dB
+
+static unsigned gcd(unsigned a, unsigned b);
+static double sinc(double x);
+static double bessel_i0(double x);
+static double dot(const double *a, const double *b, size_t n);
+static size_t resampler_output_frames(const wavresampler_t *rs, size_t frames);
+static size_t resampler_run(wavresampler_t *rs, const double *in, size_t frames,
+                            double *out, unsigned long long limit);
+
+waverror_t wav_resampler_create(wavresampler_t *rs, unsigned from, unsigned to, unsigned ch)
+{
+    unsigned p, k, c, m;
+    unsigned long long taps;
+    size_t stride;
+    double fc, width, beta, half, x, w, sum, *h;
+    assert(rs != NULL);
+
+    rs->coefs = NULL;
+    rs->work = NULL;
+    if (from == 0 || to == 0 || ch == 0) { return ERROR_BAD_DATA; }
+
+    rs->samplerate = to;
+    rs->channels = ch;
+    rs->up = to / gcd(from, to);
+    rs->down = from / gcd(from, to);
+
+    // Kaiser's estimate of the length for the attenuation over the
+    // transition band, at the upsampled rate; the band ends at the lower
+    // Nyquist, so neither aliases nor images get through
+    m = (rs->up > rs->down) ? rs->up : rs->down;
+    width = 0.5 * (RESAMPLER_STOPBAND - RESAMPLER_PASSBAND) / m;
+    taps = (unsigned long long)ceil((RESAMPLER_ATTEN - 8.0) / (2.285 * 2.0 * M_PI * width)) + 1;
+    taps = (taps + rs->up - 1) / rs->up;
+    rs->taps = (unsigned)taps;
+    rs->delay = taps * rs->up / 2;
+    rs->frames = 0;
+    rs->fed = 0;
+    rs->produced = 0;
+
+    stride = rs->taps - 1 + RESAMPLER_CHUNK;
+    rs->coefs = buffer_new((size_t)rs->up * rs->taps);
+    rs->work = buffer_new(stride * ch);
+    if (rs->coefs == NULL || rs->work == NULL) {
+        wav_resampler_destroy(rs);
+        return ERROR_MEMORY_ALLOC;
+    }
+
+    // Kaiser-windowed sinc at the upsampled rate, split into phases
+    fc = 0.25 * (RESAMPLER_PASSBAND + RESAMPLER_STOPBAND) / m;
+    beta = 0.1102 * (RESAMPLER_ATTEN - 8.7);
+    half = (double)rs->taps * rs->up / 2.0;
+    for (p = 0; p < rs->up; p++) {
+        h = rs->coefs + (size_t)p * rs->taps;
+        sum = 0;
+        for (k = 0; k < rs->taps; k++) {
+            x = (double)p + (double)(rs->taps - 1 - k) * rs->up - (double)rs->delay;
+            w = 1.0 - (x / half) * (x / half);
+            w = (w > 0) ? bessel_i0(beta * sqrt(w)) / bessel_i0(beta) : 0.0;
+            h[k] = sinc(2.0 * fc * x) * w;
+            sum += h[k];
+        }
+        // unity gain for every phase
+        for (k = 0; k < rs->taps; k++) { h[k] /= sum; }
+    }
+
+    // the signal starts after silence
+    for (c = 0; c < ch; c++) {
+        memset(rs->work + c * stride, 0, (rs->taps - 1) * sizeof(double));
+    }
+
+    return ERROR_OK;
+}
+
+void wav_resampler_destroy(wavresampler_t *rs)
+{
+    buffer_delete(rs->coefs); rs->coefs = NULL;
+    buffer_delete(rs->work); rs->work = NULL;
+}
+
+// upper bound of frames returned by one process() call; flush() returns
+// at most wav_resampler_max_output(rs, rs->taps)
+size_t wav_resampler_max_output(const wavresampler_t *rs, size_t frames)
+{
+    return resampler_output_frames(rs, frames) + 1;
+}
+
+size_t wav_resampler_process(wavresampler_t *rs, const double *in, size_t frames, double *out)
+{
+    assert(rs != NULL);
+    assert(in != NULL || frames == 0);
+    assert(out != NULL);
+
+    rs->frames += frames;
+    return resampler_run(rs, in, frames, out, ~0ULL);
+}
+
+// feeds trailing silence until the output covers all of the input
+size_t wav_resampler_flush(wavresampler_t *rs, double *out)
+{
+    unsigned long long total, last;
+    assert(rs != NULL);
+    assert(out != NULL);
+
+    total = resampler_output_frames(rs, rs->frames);
+    if (rs->produced >= total) { return 0; }
+
+    last = ((total - 1) * rs->down + rs->delay) / rs->up;
+    return resampler_run(rs, NULL, last + 1 - rs->fed, out, total);
+}
+
+static unsigned gcd(unsigned a, unsigned b)
+{
+    while (b != 0) {
+        unsigned r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+static double sinc(double x)
+{
+    return (x == 0.0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+}
+
+// modified Bessel function of the first kind, order 0 (power series)
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    int k;
+    for (k = 1; k < 50 && term > 1e-12 * sum; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// four independent partial sums let the compiler use packed multiply-adds
+static double dot(const double *a, const double *b, size_t n)
+{
+    double s[4] = { 0, 0, 0, 0 };
+    size_t k, j;
+    for (k = 0; k + 4 <= n; k += 4) {
+        for (j = 0; j < 4; j++) { s[j] += a[k + j] * b[k + j]; }
+    }
+    for (; k < n; k++) { s[0] += a[k] * b[k]; }
+    return (s[0] + s[1]) + (s[2] + s[3]);
+}
+
+static size_t resampler_output_frames(const wavresampler_t *rs, size_t frames)
+{
+    return (size_t)(((unsigned long long)frames * rs->up + rs->down - 1) / rs->down);
+}
+
+// in == NULL feeds silence
+static size_t resampler_run(wavresampler_t *rs, const double *in, size_t frames,
+                            double *out, unsigned long long limit)
+{
+    const unsigned ch = rs->channels;
+    const size_t hist = rs->taps - 1;
+    const size_t stride = hist + RESAMPLER_CHUNK;
+    size_t f, n, produced = 0;
+    unsigned long long t, i;
+    unsigned c;
+
+    while (frames > 0) {
+        n = (frames < RESAMPLER_CHUNK) ? frames : RESAMPLER_CHUNK;
+
+        // deinterleave behind the history
+        for (c = 0; c < ch; c++) {
+            double *w = rs->work + c * stride + hist;
+            for (f = 0; f < n; f++) { w[f] = (in != NULL) ? in[f * ch + c] : 0.0; }
+        }
+
+        // every output whose newest input frame is now available
+        for (;;) {
+            t = rs->produced * rs->down + rs->delay;
+            i = t / rs->up;
+            if (i >= rs->fed + n || rs->produced >= limit) { break; }
+
+            const double *h = rs->coefs + (size_t)(t % rs->up) * rs->taps;
+            for (c = 0; c < ch; c++) {
+                out[produced * ch + c] = dot(h, rs->work + c * stride + (i - rs->fed), rs->taps);
+            }
+            produced++;
+            rs->produced++;
+        }
+
+        // keep the newest taps-1 frames as history
+        for (c = 0; c < ch; c++) {
+            memmove(rs->work + c * stride, rs->work + c * stride + n, hist * sizeof(double));
+        }
+
+        rs->fed += n;
+        if (in != NULL) { in += n * ch; }
+        frames -= n;
+    }
+
+    return produced;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Write
 ///////////////////////////////////////////////////////////////////////////////
 
-static waverror_t write_header_riff(const wavdata_t *wave, FILE *fp);
-static waverror_t write_header_wave(const wavdata_t *wave, FILE *fp);
+static waverror_t write_file(const wavdata_t *wave, const char *filename, unsigned samplerate,
+                             wavstats_t *stats, const char *func);
+static unsigned long long write_riff_size(const wavdata_t *wave, const wavresampler_t *rs);
+static waverror_t write_header_riff(const wavdata_t *wave, const wavresampler_t *rs, FILE *fp);
+static waverror_t write_header_wave(const wavdata_t *wave, wavresampler_t *rs, FILE *fp, wavstats_t *stats);
+static waverror_t write_header_fmt(const wavdata_t *wave, const wavresampler_t *rs, FILE *fp);
 static waverror_t write_chunk_fmt(int sr, int ch, int fmt, int bits, FILE *fp);
-static waverror_t write_chunk_data(const double *data, size_t size, wavtype_t type, FILE *fp);
+static waverror_t write_chunk_fmt_extensible(int sr, int ch, int fmt, int bits, unsigned mask, FILE *fp);
+static waverror_t write_chunk_data(const double *data, size_t size, wavtype_t type, FILE *fp, wavstats_t *stats);
+static waverror_t write_chunk_data_resampled(const double *data, size_t size, wavtype_t type,
+                                             wavresampler_t *rs, FILE *fp, wavstats_t *stats);
+static waverror_t write_block(wavtype_t type, const double *data, size_t size, FILE *fp, wavstats_t *stats);
+static void encode_block(wavtype_t type, const double *src, uint8_t *dst, size_t n);
+static size_t count_clipped(const double *data, size_t n);
 static double limit(double sig);
 static int sig_to_uint8(double sig);
 static int sig_to_int16(double sig);
 static int sig_to_int24(double sig);
 static int sig_to_int32(double sig);
 static float sig_to_float(double sig);
+static double sig_to_double(double sig);
 static int write_int(FILE *fp, size_t bytes, int value);
-static int write_float(FILE *fp, float value);
+static void store_int(uint8_t *p, size_t bytes, int value);
+static void store_float(uint8_t *p, float value);
+static void store_double(uint8_t *p, double value);
 
 waverror_t wav_write_file(const wavdata_t *wave, const char *filename)
+{
+    return write_file(wave, filename, 0, NULL, "wav_write_file");
+}
+
+waverror_t wav_write_file_stats(const wavdata_t *wave, const char *filename, wavstats_t *stats)
+{
+    return write_file(wave, filename, 0, stats, "wav_write_file_stats");
+}
+
+waverror_t wav_write_file_resampled(const wavdata_t *wave, const char *filename, unsigned samplerate)
+{
+    return write_file(wave, filename, samplerate, NULL, "wav_write_file_resampled");
+}
+
+// func: the public entry point, as reported to the stats callback
+static waverror_t write_file(const wavdata_t *wave, const char *filename, unsigned samplerate,
+                             wavstats_t *stats, const char *func)
 {
     waverror_t err = ERROR_UNKNOWN;
     FILE *fp = NULL;
+    wavresampler_t resampler, *rs = NULL;
+    wavstats_t local;
+    unsigned long long start, t;
 
     assert(wave != NULL);
     assert(filename != NULL);
 
+    stats = stats_begin(stats, &local);
+    start = stats_clock(stats);
+
     if (wavdata_is_bad_data(wave)) {
         err = ERROR_BAD_DATA;
         goto l_error;
     }
 
-    if ((fp = fopen(filename, "wb")) == NULL) {
+    if (samplerate != 0 && samplerate != wave->samplerate) {
+        err = wav_resampler_create(&resampler, wave->samplerate, samplerate, wave->channels);
+        if (err != ERROR_OK) { goto l_error; }
+        rs = &resampler;
+    }
+
+    // the RIFF size field is 32 bits wide
+    if (write_riff_size(wave, rs) > 0xFFFFFFFFULL) {
+        err = ERROR_BAD_DATA;
+        goto l_error;
+    }
+
+    t = stats_clock(stats);
+    fp = fopen(filename, "wb");
+    stats_io(stats, t);
+    if (fp == NULL) {
         err = ERROR_UNABLE_TO_OPEN;
         goto l_error;
     }
 
-    err = write_header_riff(wave, fp);
+    err = write_header_riff(wave, rs, fp);
 	if (err != ERROR_OK) { goto l_error; }
 
-    err = write_header_wave(wave, fp);
+    err = write_header_wave(wave, rs, fp, stats);
     if (err != ERROR_OK) { goto l_error; }
 
     err = ERROR_OK;
 
 l_error:
-    if (fp != NULL) { fclose(fp); }
+    if (fp != NULL) {
+        if (stats != NULL) { stats->bytes_written = ftell(fp); }
+        t = stats_clock(stats);
+        fclose(fp);
+        stats_io(stats, t);
+    }
+    if (rs != NULL) { wav_resampler_destroy(rs); }
+    stats_end(stats, func, err, start);
 	return err;
 }
 
-static waverror_t write_header_riff(const wavdata_t *wave, FILE *fp)
+// value of the RIFF size field: everything after it
+static unsigned long long write_riff_size(const wavdata_t *wave, const wavresampler_t *rs)
+{
+    unsigned long long size = wave->size;
+    if (rs != NULL) {
+        size = resampler_output_frames(rs, wave->size / wave->channels) * wave->channels;
+    }
+    return (wavdata_is_extensible(wave) ? 60 : 36) + size * wavtype_get_bits(wave->type) / 8;
+}
+
+static waverror_t write_header_riff(const wavdata_t *wave, const wavresampler_t *rs, FILE *fp)
 {
     assert(wave != NULL);
     assert(wave->size > 0);
@@ -187,12 +622,36 @@ static waverror_t write_header_riff(const wavdata_t *wave, FILE *fp)
     if (ferror(fp)) { return ERROR_WRITE_FAULT; }
 
 	fwrite((char *) RIFF_HEADER, sizeof(RIFF_HEADER), 1, fp);
-	write_int(fp, 4, 36 + wave->size * wavtype_get_bits(wave->type) / 8);
+	write_int(fp, 4, (int)write_riff_size(wave, rs));
+
+    return ERROR_OK;
+}
+
+static waverror_t write_header_wave(const wavdata_t *wave, wavresampler_t *rs, FILE *fp, wavstats_t *stats)
+{
+    waverror_t err;
+    assert(wave != NULL);
+    assert(wave->type != TYPE_UNKNOWN);
+    assert(fp != NULL);
+    if (ferror(fp)) { return ERROR_WRITE_FAULT; }
+
+    // "WAVE" header and "fmt " chunk
+    err = write_header_fmt(wave, rs, fp);
+    if (err != ERROR_OK) { return err; }
+
+	// "data" chunk
+    if (rs != NULL) {
+        err = write_chunk_data_resampled(wave->data, wave->size, wave->type, rs, fp, stats);
+    }
+    else {
+        err = write_chunk_data(wave->data, wave->size, wave->type, fp, stats);
+    }
+    if (err != ERROR_OK) { return err; }
 
     return ERROR_OK;
 }
 
-static waverror_t write_header_wave(const wavdata_t *wave, FILE *fp)
+static waverror_t write_header_fmt(const wavdata_t *wave, const wavresampler_t *rs, FILE *fp)
 {
     int bits, fmt;
     waverror_t err;
@@ -202,17 +661,20 @@ static waverror_t write_header_wave(const wavdata_t *wave, FILE *fp)
     if (ferror(fp)) { return ERROR_WRITE_FAULT; }
 
     bits = wavtype_get_bits(wave->type);
-    fmt = (wave->type == TYPE_FLOAT) ? (0x03) : (0x01);
+    fmt = (wave->type == TYPE_FLOAT || wave->type == TYPE_DOUBLE) ? (0x03) : (0x01);
 
     // "WAVE" header
     fwrite((char *) WAVE_HEADER, sizeof(WAVE_HEADER), 1, fp);
 
     // "fmt " chunk
-    err = write_chunk_fmt(wave->samplerate, wave->channels, fmt, bits, fp);
-    if (err != ERROR_OK) { return err; }
-
-	// "data" chunk
-    err = write_chunk_data(wave->data, wave->size, wave->type, fp);
+    if (wavdata_is_extensible(wave)) {
+        err = write_chunk_fmt_extensible((rs != NULL) ? rs->samplerate : wave->samplerate,
+                                         wave->channels, fmt, bits, wavdata_get_mask(wave), fp);
+    }
+    else {
+        err = write_chunk_fmt((rs != NULL) ? rs->samplerate : wave->samplerate,
+                              wave->channels, fmt, bits, fp);
+    }
     if (err != ERROR_OK) { return err; }
 
     return ERROR_OK;
@@ -239,9 +701,34 @@ static waverror_t write_chunk_fmt(int sr, int ch, int fmt, int bits, FILE *fp)
     return ERROR_OK;
 }
 
-static waverror_t write_chunk_data(const double *data, size_t size, wavtype_t type, FILE *fp)
+static waverror_t write_chunk_fmt_extensible(int sr, int ch, int fmt, int bits, unsigned mask, FILE *fp)
+{
+    assert(sr > 0);
+    assert(ch > 0);
+    assert(fmt != 0);
+    assert(bits > 0 && (bits % 2) == 0);
+    assert(fp != NULL);
+    if (ferror(fp)) { return ERROR_WRITE_FAULT; }
+
+    fwrite((char *) FMT__HEADER, sizeof(FMT__HEADER), 1, fp);
+    write_int(fp, 4, 40);
+    write_int(fp, 2, 0xFFFE);
+    write_int(fp, 2, ch);
+    write_int(fp, 4, sr);
+    write_int(fp, 4, sr * ch * bits / 8);
+    write_int(fp, 2, ch * bits / 8);
+    write_int(fp, 2, bits);
+    write_int(fp, 2, 22);                   // cbSize
+    write_int(fp, 2, bits);                 // ValidBitsPerSample
+    write_int(fp, 4, (int)mask);            // ChannelMask
+    write_int(fp, 2, fmt);                  // SubFormat
+    fwrite((char *) SUBFORMAT_GUID + 2, sizeof(SUBFORMAT_GUID) - 2, 1, fp);
+
+    return ERROR_OK;
+}
+
+static waverror_t write_chunk_data(const double *data, size_t size, wavtype_t type, FILE *fp, wavstats_t *stats)
 {
-    int i;
     assert(data != NULL);
     assert(size > 0);
     assert(type != TYPE_UNKNOWN);
@@ -251,28 +738,131 @@ static waverror_t write_chunk_data(const double *data, size_t size, wavtype_t ty
 	fwrite((char *) DATA_HEADER, sizeof(DATA_HEADER), 1, fp);
 	write_int(fp, 4, size * wavtype_get_bits(type) / 8);
 
+    return write_block(type, data, size, fp, stats);
+}
+
+static waverror_t write_chunk_data_resampled(const double *data, size_t size, wavtype_t type,
+                                             wavresampler_t *rs, FILE *fp, wavstats_t *stats)
+{
+    waverror_t err = ERROR_OK;
+    const unsigned ch = rs->channels;
+    size_t i, n, frames, block_frames, produced;
+    double *out;
+    unsigned long long t;
+    assert(data != NULL);
+    assert(size > 0);
+    assert(type != TYPE_UNKNOWN);
+    assert(fp != NULL);
+    if (ferror(fp)) { return ERROR_WRITE_FAULT; }
+
+    frames = size / ch;
+    block_frames = (BLOCK_SAMPLES > ch) ? (BLOCK_SAMPLES / ch) : 1;
+
+	fwrite((char *) DATA_HEADER, sizeof(DATA_HEADER), 1, fp);
+	write_int(fp, 4, resampler_output_frames(rs, frames) * ch * wavtype_get_bits(type) / 8);
+
+    // resampled while the block is still in cache, then encoded
+    n = (block_frames > rs->taps) ? block_frames : rs->taps;
+    out = buffer_new(wav_resampler_max_output(rs, n) * ch);
+    if (out == NULL) { return ERROR_MEMORY_ALLOC; }
+
+    for (i = 0; i < frames && err == ERROR_OK; i += n) {
+        n = frames - i;
+        if (n > block_frames) { n = block_frames; }
+
+        t = stats_clock(stats);
+        produced = wav_resampler_process(rs, data + i * ch, n, out);
+        stats_convert(stats, t);
+
+        err = write_block(type, out, produced * ch, fp, stats);
+    }
+
+    if (err == ERROR_OK) {
+        t = stats_clock(stats);
+        produced = wav_resampler_flush(rs, out);
+        stats_convert(stats, t);
+
+        err = write_block(type, out, produced * ch, fp, stats);
+    }
+
+    buffer_delete(out);
+    return err;
+}
+
+static waverror_t write_block(wavtype_t type, const double *data, size_t size, FILE *fp, wavstats_t *stats)
+{
+    uint8_t block[BLOCK_SAMPLES * 8];
+    size_t i, n, bytes;
+    unsigned long long t;
+
+    if (type == TYPE_UNKNOWN) {
+        assert("Unknown or unsupported format");
+        return ERROR_BAD_DATA;
+    }
+    bytes = wavtype_get_bits(type) / 8;
+
+    // nothing to convert: write straight from the caller's buffer
+    if (wavtype_is_native(type)) {
+        t = stats_clock(stats);
+        if (fwrite(data, bytes, size, fp) != size) { return ERROR_WRITE_FAULT; }
+        stats_io(stats, t);
+        return ERROR_OK;
+    }
+
+    for (i = 0; i < size; i += n) {
+        n = size - i;
+        if (n > BLOCK_SAMPLES) { n = BLOCK_SAMPLES; }
+
+        t = stats_clock(stats);
+        encode_block(type, data + i, block, n);
+        if (stats != NULL && type != TYPE_FLOAT && type != TYPE_DOUBLE) {
+            stats->clipped += count_clipped(data + i, n);
+        }
+        stats_convert(stats, t);
+
+        t = stats_clock(stats);
+        if (fwrite(block, bytes, n, fp) != n) { return ERROR_WRITE_FAULT; }
+        stats_io(stats, t);
+    }
+
+    return ERROR_OK;
+}
+
+static void encode_block(wavtype_t type, const double *src, uint8_t *dst, size_t n)
+{
+    size_t i;
+
     switch (type) {
     case TYPE_UINT8:
-		for (i = 0; i < size; i++) { write_int(fp, 1, sig_to_uint8(data[i])); }
+        for (i = 0; i < n; i++) { dst[i] = (uint8_t)sig_to_uint8(src[i]); }
         break;
     case TYPE_INT16:
-		for (i = 0; i < size; i++) { write_int(fp, 2, sig_to_int16(data[i])); }
+        for (i = 0; i < n; i++) { store_int(dst + i * 2, 2, sig_to_int16(src[i])); }
         break;
     case TYPE_INT24:
-		for (i = 0; i < size; i++) { write_int(fp, 3, sig_to_int24(data[i])); }
+        for (i = 0; i < n; i++) { store_int(dst + i * 3, 3, sig_to_int24(src[i])); }
         break;
     case TYPE_INT32:
-		for (i = 0; i < size; i++) { write_int(fp, 4, sig_to_int32(data[i])); }
+        for (i = 0; i < n; i++) { store_int(dst + i * 4, 4, sig_to_int32(src[i])); }
         break;
     case TYPE_FLOAT:
-        for (i = 0; i < size; i++) { write_float(fp, sig_to_float(data[i])); }
+        for (i = 0; i < n; i++) { store_float(dst + i * 4, sig_to_float(src[i])); }
+        break;
+    case TYPE_DOUBLE:
+        for (i = 0; i < n; i++) { store_double(dst + i * 8, sig_to_double(src[i])); }
         break;
     default:
-        assert("Unknown or unsupported format");
-        return ERROR_BAD_DATA;
+        break;
     }
+}
 
-    return ERROR_OK;
+static size_t count_clipped(const double *data, size_t n)
+{
+    size_t i, clipped = 0;
+    for (i = 0; i < n; i++) {
+        clipped += (data[i] > +1.0 || data[i] < -1.0);
+    }
+    return clipped;
 }
 
 static double limit(double sig)
@@ -287,6 +877,7 @@ static int sig_to_int16(double sig) { return (int)(limit(sig) * 32767); }
 static int sig_to_int24(double sig) { return (int)(limit(sig) * 8388607); }
 static int sig_to_int32(double sig) { return (int)(limit(sig) * 2147483647); }
 static float sig_to_float(double sig) { return (float) sig; }
+static double sig_to_double(double sig) { return sig; }
 
 static int write_int(FILE *fp, size_t bytes, int value)
 {
@@ -297,44 +888,278 @@ static int write_int(FILE *fp, size_t bytes, int value)
     return 1;
 }
 
-static int write_float(FILE *fp, float value)
+static void store_int(uint8_t *p, size_t bytes, int value)
+{
+    uint32_t v = (uint32_t)value;
+    while (bytes--) {
+        *p++ = v & 0xff;
+        v >>= 8;
+    }
+}
+
+static void store_float(uint8_t *p, float value)
 {
-    return fwrite(&value, sizeof(value), 1, fp) == sizeof(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+static void store_double(uint8_t *p, double value)
+{
+    int i;
+    uint64_t v;
+    memcpy(&v, &value, sizeof(v));
+    for (i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(v >> (i * 8));
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Read
+// Write (O_DIRECT)
 ///////////////////////////////////////////////////////////////////////////////
 
-static waverror_t read_header_riff(size_t *filesize, FILE *fp);
-static waverror_t read_header_wave(wavdata_t *wave, size_t filesize, FILE *fp);
-static waverror_t read_chunk_body(const char *sig, size_t size, wavdata_t *wave, FILE *fp);
-static waverror_t read_chunk_fmt(wavdata_t *wave, FILE *fp);
-static waverror_t read_chunk_data(wavdata_t *wave, FILE *fp);
-static double uint8_to_sig(uint8_t data);
-static double int16_to_sig(int16_t data);
-static double int24_to_sig(int32_t data);
-static double int32_to_sig(int32_t data);
-static double float_to_sig(float data);
-static int read_int(FILE *fp, size_t bytes);
-static float read_float(FILE *fp);
+#define DIRECT_ALIGN  4096          // header size and write alignment
+#define DIRECT_BUFFER (1 << 20)     // staging buffer
 
-waverror_t wav_read_file(wavdata_t *wave, const char *filename)
+#if defined(__linux__) && defined(O_DIRECT)
+static waverror_t direct_write_data(const wavdata_t *wave, int fd, uint8_t *staging, int *refused, wavstats_t *stats);
+static waverror_t direct_make_header(const wavdata_t *wave, uint8_t *block);
+#endif
+
+waverror_t wav_write_file_direct(const wavdata_t *wave, const char *filename)
 {
-	waverror_t err = ERROR_BROKEN;
-    FILE *fp = NULL;
-    size_t filesize;
+#if defined(__linux__) && defined(O_DIRECT)
+    waverror_t err = ERROR_UNKNOWN;
+    int fd = -1, refused = 0;
+    uint8_t *staging = NULL;
+    size_t bytes;
+    wavstats_t local, *stats;
+    unsigned long long start, t;
 
     assert(wave != NULL);
     assert(filename != NULL);
 
-    wave->samplerate = 0;
-    wave->channels = 0;
-    wave->size = 0;
-    wave->data = NULL;
-    wave->type = TYPE_UNKNOWN;
+    stats = stats_begin(NULL, &local);
+    start = stats_clock(stats);
 
+    if (wavdata_is_bad_data(wave)) {
+        err = ERROR_BAD_DATA;
+        goto l_error;
+    }
+
+    // the RIFF size field is 32 bits wide, and the header block counts
+    bytes = wave->size * wavtype_get_bits(wave->type) / 8;
+    if ((unsigned long long)DIRECT_ALIGN + bytes > 0xFFFFFFFFULL) {
+        err = ERROR_BAD_DATA;
+        goto l_error;
+    }
+
+    if (posix_memalign((void **)&staging, DIRECT_ALIGN, DIRECT_BUFFER) != 0) {
+        staging = NULL;
+        err = ERROR_MEMORY_ALLOC;
+        goto l_error;
+    }
+
+    t = stats_clock(stats);
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+    stats_io(stats, t);
+    if (fd < 0) {
+        refused = (errno == EINVAL);
+        err = ERROR_UNABLE_TO_OPEN;
+        goto l_error;
+    }
+
+    // samples start right after the header block
+    err = direct_write_data(wave, fd, staging, &refused, stats);
+    if (err != ERROR_OK) { goto l_error; }
+
+    // the header goes last, so an interrupted file is never mistaken
+    // for a complete one
+    err = direct_make_header(wave, staging);
+    if (err != ERROR_OK) { goto l_error; }
+
+    t = stats_clock(stats);
+    if (pwrite(fd, staging, DIRECT_ALIGN, 0) != DIRECT_ALIGN) {
+        refused = (errno == EINVAL);
+        err = ERROR_WRITE_FAULT;
+        goto l_error;
+    }
+    stats_io(stats, t);
+
+    // drop the padding of the last block
+    if (ftruncate(fd, DIRECT_ALIGN + bytes) != 0) {
+        err = ERROR_WRITE_FAULT;
+        goto l_error;
+    }
+    if (stats != NULL) { stats->bytes_written = DIRECT_ALIGN + bytes; }
+
+    err = ERROR_OK;
+
+l_error:
+    if (fd >= 0) {
+        t = stats_clock(stats);
+        close(fd);
+        stats_io(stats, t);
+    }
+    free(staging);
+
+    // the filesystem does not do O_DIRECT: go through the page cache,
+    // which reports the result itself
+    if (refused) { return write_file(wave, filename, 0, NULL, "wav_write_file_direct"); }
+
+    stats_end(stats, "wav_write_file_direct", err, start);
+	return err;
+#else
+    return write_file(wave, filename, 0, NULL, "wav_write_file_direct");
+#endif
+}
+
+#if defined(__linux__) && defined(O_DIRECT)
+static waverror_t direct_write_data(const wavdata_t *wave, int fd, uint8_t *staging, int *refused, wavstats_t *stats)
+{
+    const size_t bytes = wavtype_get_bits(wave->type) / 8;
+    size_t i = 0, n, fill = 0, aligned;
+    off_t offset = DIRECT_ALIGN;
+    unsigned long long t;
+
+    while (i < wave->size) {
+        // encode as many samples as fit behind the previous remainder
+        n = (DIRECT_BUFFER - fill) / bytes;
+        if (n > wave->size - i) { n = wave->size - i; }
+
+        t = stats_clock(stats);
+        encode_block(wave->type, wave->data + i, staging + fill, n);
+        if (stats != NULL && wave->type != TYPE_FLOAT && wave->type != TYPE_DOUBLE) {
+            stats->clipped += count_clipped(wave->data + i, n);
+        }
+        stats_convert(stats, t);
+        i += n;
+        fill += n * bytes;
+
+        // the last block is zero-padded, and truncated afterwards
+        if (i == wave->size) {
+            aligned = (fill + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+            memset(staging + fill, 0, aligned - fill);
+        }
+        else {
+            aligned = fill & ~(size_t)(DIRECT_ALIGN - 1);
+        }
+
+        t = stats_clock(stats);
+        if (pwrite(fd, staging, aligned, offset) != (ssize_t)aligned) {
+            *refused = (errno == EINVAL);
+            return ERROR_WRITE_FAULT;
+        }
+        stats_io(stats, t);
+        offset += aligned;
+
+        // keep the unaligned remainder for the next write
+        if (i < wave->size) {
+            memmove(staging, staging + aligned, fill - aligned);
+            fill -= aligned;
+        }
+    }
+
+    return ERROR_OK;
+}
+
+// RIFF, WAVE and "fmt " as usual, then a "JUNK" chunk that pads the header
+// so that the "data" chunk body starts at DIRECT_ALIGN
+static waverror_t direct_make_header(const wavdata_t *wave, uint8_t *block)
+{
+    FILE *fp;
+    waverror_t err;
+    size_t bytes = wave->size * wavtype_get_bits(wave->type) / 8;
+
+    memset(block, 0, DIRECT_ALIGN);
+    fp = fmemopen(block, DIRECT_ALIGN, "wb");
+    if (fp == NULL) { return ERROR_MEMORY_ALLOC; }
+
+    fwrite((char *) RIFF_HEADER, sizeof(RIFF_HEADER), 1, fp);
+    write_int(fp, 4, DIRECT_ALIGN - 8 + bytes);
+
+    err = write_header_fmt(wave, NULL, fp);
+    if (err == ERROR_OK) {
+        long pos = ftell(fp);
+        fwrite((char *) JUNK_HEADER, sizeof(JUNK_HEADER), 1, fp);
+        write_int(fp, 4, DIRECT_ALIGN - pos - 16);
+        while (ftell(fp) < DIRECT_ALIGN - 8) { fputc(0, fp); }
+
+        // the buffer ends exactly here, so fclose() appends no '\0'
+        fwrite((char *) DATA_HEADER, sizeof(DATA_HEADER), 1, fp);
+        write_int(fp, 4, bytes);
+        if (ftell(fp) != DIRECT_ALIGN) { err = ERROR_UNKNOWN; }
+    }
+
+    fclose(fp);
+    return err;
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Read
+///////////////////////////////////////////////////////////////////////////////
+
+static waverror_t read_header_riff(size_t *filesize, FILE *fp);
+static waverror_t read_file(wavdata_t *wave, const char *filename, unsigned samplerate,
+                            wavstats_t *stats, const char *func);
+static waverror_t read_header_wave(wavdata_t *wave, size_t filesize, unsigned samplerate, FILE *fp, wavstats_t *stats);
+static waverror_t read_chunk_body(const char *sig, size_t size, wavdata_t *wave, unsigned samplerate, FILE *fp, wavstats_t *stats);
+static waverror_t read_chunk_fmt(wavdata_t *wave, size_t size, FILE *fp);
+static waverror_t read_chunk_data(wavdata_t *wave, FILE *fp, wavstats_t *stats);
+static waverror_t read_chunk_data_resampled(wavdata_t *wave, unsigned samplerate, FILE *fp, wavstats_t *stats);
+static size_t read_block(wavtype_t type, double *data, size_t size, FILE *fp, wavstats_t *stats);
+static void decode_block(wavtype_t type, const uint8_t *src, double *dst, size_t n);
+static double uint8_to_sig(uint8_t data);
+static double int16_to_sig(int16_t data);
+static double int24_to_sig(int32_t data);
+static double int32_to_sig(int32_t data);
+static double float_to_sig(float data);
+static double double_to_sig(double data);
+static int read_int(FILE *fp, size_t bytes);
+static int load_int(const uint8_t *p, size_t bytes);
+static float load_float(const uint8_t *p);
+static double load_double(const uint8_t *p);
+
+waverror_t wav_read_file(wavdata_t *wave, const char *filename)
+{
+    return read_file(wave, filename, 0, NULL, "wav_read_file");
+}
+
+waverror_t wav_read_file_stats(wavdata_t *wave, const char *filename, wavstats_t *stats)
+{
+    return read_file(wave, filename, 0, stats, "wav_read_file_stats");
+}
+
+waverror_t wav_read_file_resampled(wavdata_t *wave, const char *filename, unsigned samplerate)
+{
+    return read_file(wave, filename, samplerate, NULL, "wav_read_file_resampled");
+}
+
+// func: the public entry point, as reported to the stats callback
+static waverror_t read_file(wavdata_t *wave, const char *filename, unsigned samplerate,
+                            wavstats_t *stats, const char *func)
+{
+	waverror_t err = ERROR_BROKEN;
+    FILE *fp = NULL;
+    size_t filesize;
+    wavstats_t local;
+    unsigned long long start, t;
+
+    assert(wave != NULL);
+    assert(filename != NULL);
+
+    stats = stats_begin(stats, &local);
+    start = stats_clock(stats);
+
+    wave->samplerate = 0;
+    wave->channels = 0;
+    wave->size = 0;
+    wave->data = NULL;
+    wave->type = TYPE_UNKNOWN;
+    wavdata_set_mask(wave, 0);
+
+    t = stats_clock(stats);
     fp = fopen(filename, "rb");
+    stats_io(stats, t);
     if (fp == NULL) {
         err = ERROR_UNABLE_TO_OPEN;
         goto l_error;
@@ -346,13 +1171,18 @@ waverror_t wav_read_file(wavdata_t *wave, const char *filename)
     if (err != ERROR_OK) { goto l_error; }
 
 	// WAVE header
-    err = read_header_wave(wave, filesize, fp);
+    err = read_header_wave(wave, filesize, samplerate, fp, stats);
     if (err != ERROR_OK) { goto l_error; }
 
 	err = ERROR_OK;
 
 l_error:
-    if (fp != NULL) { fclose(fp); }
+    if (fp != NULL) {
+        t = stats_clock(stats);
+        fclose(fp);
+        stats_io(stats, t);
+    }
+    stats_end(stats, func, err, start);
 	return err;
 }
 
@@ -372,9 +1202,10 @@ static waverror_t read_header_riff(size_t *filesize, FILE *fp)
     return ERROR_OK;
 }
 
-static waverror_t read_header_wave(wavdata_t *wave, size_t filesize, FILE *fp)
+static waverror_t read_header_wave(wavdata_t *wave, size_t filesize, unsigned samplerate, FILE *fp, wavstats_t *stats)
 {
     char sig[4];
+    unsigned long long t;
 
     assert(wave != NULL);
     assert(fp != NULL);
@@ -384,26 +1215,35 @@ static waverror_t read_header_wave(wavdata_t *wave, size_t filesize, FILE *fp)
     	memcmp(sig, WAVE_HEADER, sizeof(WAVE_HEADER)) != 0) {
         return ERROR_NOT_WAVE;
 	}
+    if (stats != NULL) { stats->bytes_read = 12; }     // "RIFF", size, "WAVE"
 
 	// read chunks
 	while (!feof(fp) && !ferror(fp) && ftell(fp) < filesize) {
+		off_t head = ftell(fp);
+
 		// read the chunk header
 		if (fread(sig, 1, sizeof(sig), fp) != sizeof(sig)) { break; }
 		size_t size = read_int(fp, 4);
 		off_t pos = ftell(fp);
 
 		// read the chunk body
-        waverror_t err = read_chunk_body(sig, size, wave, fp);
+        waverror_t err = read_chunk_body(sig, size, wave, samplerate, fp, stats);
+
+        // only reads moved the position so far: it counts what they
+        // returned, unlike the seek below that may pass EOF
+        if (stats != NULL) { stats->bytes_read += ftell(fp) - head; }
         if (err != ERROR_OK) { return err; }
 
 		// move to the next chunk
+		t = stats_clock(stats);
 		fseek(fp, pos + size, SEEK_SET);
+		stats_io(stats, t);
 	}
 
     return ERROR_OK;
 }
 
-static waverror_t read_chunk_body(const char *sig, size_t size, wavdata_t *wave, FILE *fp)
+static waverror_t read_chunk_body(const char *sig, size_t size, wavdata_t *wave, unsigned samplerate, FILE *fp, wavstats_t *stats)
 {
     assert(sig != NULL);
     assert(wave != NULL);
@@ -412,7 +1252,7 @@ static waverror_t read_chunk_body(const char *sig, size_t size, wavdata_t *wave,
 
     if (memcmp(sig, FMT__HEADER, sizeof(FMT__HEADER)) == 0) {
         // "fmt " chunk
-        waverror_t err = read_chunk_fmt(wave, fp);
+        waverror_t err = read_chunk_fmt(wave, size, fp);
         if (err != ERROR_OK) { return err; }
     }
     else if (memcmp(sig, DATA_HEADER, sizeof(DATA_HEADER)) == 0) {
@@ -423,21 +1263,27 @@ static waverror_t read_chunk_body(const char *sig, size_t size, wavdata_t *wave,
             return ERROR_OK;
         }
 
+        if (samplerate != 0 && samplerate != wave->samplerate) {
+            return read_chunk_data_resampled(wave, samplerate, fp, stats);
+        }
+
         wave->data = buffer_new(wave->size);
         if (wave->data == NULL) {
             return ERROR_MEMORY_ALLOC;
         }
 
-        waverror_t err = read_chunk_data(wave, fp);
+        waverror_t err = read_chunk_data(wave, fp, stats);
         if (err != ERROR_OK) { return err; }
     }
 
     return ERROR_OK;
 }
 
-static waverror_t read_chunk_fmt(wavdata_t *wave, FILE *fp)
+static waverror_t read_chunk_fmt(wavdata_t *wave, size_t size, FILE *fp)
 {
-    int fmt, bits;
+    int fmt, bits, valid;
+    unsigned mask;
+    uint8_t guid[16];
     assert(wave != NULL);
     assert(fp != NULL);
     if (feof(fp) || ferror(fp)) { return ERROR_BROKEN; }
@@ -448,6 +1294,30 @@ static waverror_t read_chunk_fmt(wavdata_t *wave, FILE *fp)
     read_int(fp, 4);                        // BytePerSec
     read_int(fp, 2);                        // BlockAlign
     bits = read_int(fp, 2);                 // BitPerSample
+    wavdata_set_mask(wave, 0);
+
+    if (fmt == 0xFFFE) {
+        // WAVE_FORMAT_EXTENSIBLE
+        if (size < 40 || read_int(fp, 2) < 22) {    // cbSize
+            return ERROR_BROKEN;
+        }
+        valid = read_int(fp, 2);                    // ValidBitsPerSample
+        mask = read_int(fp, 4);                     // ChannelMask
+        if (fread(guid, 1, sizeof(guid), fp) != sizeof(guid)) {
+            return ERROR_BROKEN;
+        }
+        if (memcmp(guid + 2, SUBFORMAT_GUID + 2, sizeof(guid) - 2) != 0) {
+            return ERROR_UNSUPPORTED;
+        }
+        fmt = guid[0] | (guid[1] << 8);             // SubFormat
+
+        // narrower samples are left-justified in the container
+        if (valid > bits) { return ERROR_BROKEN; }
+
+        // a mask that doesn't name every channel is dropped (left at 0),
+        // it couldn't be written back
+        wav_set_channelmask(wave, mask);
+    }
 
     wave->type = wavtype_create(fmt, bits);
     if (wave->type == TYPE_UNKNOWN) {
@@ -457,46 +1327,149 @@ static waverror_t read_chunk_fmt(wavdata_t *wave, FILE *fp)
     return ERROR_OK;
 }
 
-static waverror_t read_chunk_data(wavdata_t *wave, FILE *fp)
+static waverror_t read_chunk_data(wavdata_t *wave, FILE *fp, wavstats_t *stats)
 {
-    int i;
+    size_t i, n, got;
     assert(wave != NULL);
     assert(wave->size > 0);
     assert(wave->data != NULL);
     assert(fp != NULL);
     if (feof(fp) || ferror(fp)) { return ERROR_BROKEN; }
 
-    switch (wave->type) {
-    case TYPE_UINT8:
-        for (i = 0; i < wave->size; i++) {
-            wave->data[i] = uint8_to_sig(read_int(fp, 1));
+    if (wave->type == TYPE_UNKNOWN) { return ERROR_UNSUPPORTED; }
+
+    // nothing to convert: read the whole chunk straight into wave->data
+    if (wavtype_is_native(wave->type)) {
+        unsigned long long t = stats_clock(stats);
+        got = fread(wave->data, sizeof(double), wave->size, fp);
+        stats_io(stats, t);
+        for (i = got; i < wave->size; i++) { wave->data[i] = 0.0; }
+        return ERROR_OK;
+    }
+
+    for (i = 0; i < wave->size; i += n) {
+        n = wave->size - i;
+        if (n > BLOCK_SAMPLES) { n = BLOCK_SAMPLES; }
+
+        got = read_block(wave->type, wave->data + i, n, fp, stats);
+
+        // the file is shorter than its "data" chunk: pad with silence
+        if (got < n) {
+            for (i += got; i < wave->size; i++) { wave->data[i] = 0.0; }
+            break;
         }
+    }
+
+    return ERROR_OK;
+}
+
+static waverror_t read_chunk_data_resampled(wavdata_t *wave, unsigned samplerate, FILE *fp, wavstats_t *stats)
+{
+    waverror_t err;
+    wavresampler_t rs;
+    double block[BLOCK_SAMPLES];
+    size_t i, n, got, pos, frames, block_frames;
+    unsigned long long t;
+    assert(wave != NULL);
+    assert(wave->size > 0);
+    assert(wave->data == NULL);
+    assert(fp != NULL);
+    if (feof(fp) || ferror(fp)) { return ERROR_BROKEN; }
+
+    if (wave->type == TYPE_UNKNOWN) { return ERROR_UNSUPPORTED; }
+    if (wave->channels == 0 || wave->channels > BLOCK_SAMPLES) { return ERROR_UNSUPPORTED; }
+
+    err = wav_resampler_create(&rs, wave->samplerate, samplerate, wave->channels);
+    if (err != ERROR_OK) { return err; }
+
+    // only the resampled signal is allocated in full
+    frames = wave->size / wave->channels;
+    block_frames = BLOCK_SAMPLES / wave->channels;
+    wave->samplerate = samplerate;
+    wave->size = resampler_output_frames(&rs, frames) * wave->channels;
+    wave->data = buffer_new(wave->size);
+    if (wave->data == NULL) {
+        wav_resampler_destroy(&rs);
+        return ERROR_MEMORY_ALLOC;
+    }
+
+    pos = 0;
+    for (i = 0; i < frames; i += n) {
+        n = frames - i;
+        if (n > block_frames) { n = block_frames; }
+
+        got = read_block(wave->type, block, n * wave->channels, fp, stats) / wave->channels;
+
+        t = stats_clock(stats);
+        pos += wav_resampler_process(&rs, block, got, wave->data + pos) * wave->channels;
+        stats_convert(stats, t);
+
+        if (got < n) { break; }
+    }
+
+    t = stats_clock(stats);
+    pos += wav_resampler_flush(&rs, wave->data + pos) * wave->channels;
+    stats_convert(stats, t);
+
+    // the file is shorter than its "data" chunk: pad with silence
+    for (; pos < wave->size; pos++) { wave->data[pos] = 0.0; }
+
+    wav_resampler_destroy(&rs);
+    return ERROR_OK;
+}
+
+// returns the number of samples actually read (size <= BLOCK_SAMPLES)
+static size_t read_block(wavtype_t type, double *data, size_t size, FILE *fp, wavstats_t *stats)
+{
+    uint8_t block[BLOCK_SAMPLES * 8];
+    size_t got;
+    unsigned long long t;
+    assert(size <= BLOCK_SAMPLES);
+
+    if (wavtype_is_native(type)) {
+        t = stats_clock(stats);
+        got = fread(data, sizeof(double), size, fp);
+        stats_io(stats, t);
+        return got;
+    }
+
+    t = stats_clock(stats);
+    got = fread(block, wavtype_get_bits(type) / 8, size, fp);
+    stats_io(stats, t);
+
+    t = stats_clock(stats);
+    decode_block(type, block, data, got);
+    stats_convert(stats, t);
+
+    return got;
+}
+
+static void decode_block(wavtype_t type, const uint8_t *src, double *dst, size_t n)
+{
+    size_t i;
+
+    switch (type) {
+    case TYPE_UINT8:
+        for (i = 0; i < n; i++) { dst[i] = uint8_to_sig(src[i]); }
         break;
     case TYPE_INT16:
-        for (i = 0; i < wave->size; i++) {
-            wave->data[i] = int16_to_sig(read_int(fp, 2));
-        }
+        for (i = 0; i < n; i++) { dst[i] = int16_to_sig(load_int(src + i * 2, 2)); }
         break;
     case TYPE_INT24:
-        for (i = 0; i < wave->size; i++) {
-            wave->data[i] = int24_to_sig(read_int(fp, 3));
-        }
+        for (i = 0; i < n; i++) { dst[i] = int24_to_sig(load_int(src + i * 3, 3)); }
         break;
     case TYPE_INT32:
-        for (i = 0; i < wave->size; i++) {
-            wave->data[i] = int32_to_sig(read_int(fp, 4));
-        }
+        for (i = 0; i < n; i++) { dst[i] = int32_to_sig(load_int(src + i * 4, 4)); }
         break;
     case TYPE_FLOAT:
-        for (i = 0; i < wave->size; i++) {
-            wave->data[i] = float_to_sig(read_float(fp));
-        }
+        for (i = 0; i < n; i++) { dst[i] = float_to_sig(load_float(src + i * 4)); }
+        break;
+    case TYPE_DOUBLE:
+        for (i = 0; i < n; i++) { dst[i] = double_to_sig(load_double(src + i * 8)); }
         break;
     default:
-        return ERROR_UNSUPPORTED;
+        break;
     }
-
-    return ERROR_OK;
 }
 
 static double uint8_to_sig(uint8_t data) { return (data - 128.0) / 127.0; }
@@ -506,6 +1479,7 @@ static double int24_to_sig(int32_t data) {
 }
 static double int32_to_sig(int32_t data) { return data / 2147483647.0; }
 static double float_to_sig(float data) { return (double)data; }
+static double double_to_sig(double data) { return data; }
 
 static int read_int(FILE *fp, size_t bytes)
 {
@@ -516,8 +1490,480 @@ static int read_int(FILE *fp, size_t bytes)
     return value;
 }
 
-static float read_float(FILE *fp)
+static int load_int(const uint8_t *p, size_t bytes)
+{
+    size_t i;
+    uint32_t value = 0;
+    for (i = 0; i < bytes; i++) {
+        value |= (uint32_t)p[i] << (i * 8);
+    }
+    return (int)value;
+}
+
+static float load_float(const uint8_t *p)
 {
     float data;
-    return fread(&data, sizeof(data), 1, fp) == sizeof(data);
+    memcpy(&data, p, sizeof(data));
+    return data;
+}
+
+static double load_double(const uint8_t *p)
+{
+    int i;
+    uint64_t v = 0;
+    double data;
+    for (i = 0; i < 8; i++) {
+        v |= (uint64_t)p[i] << (i * 8);
+    }
+    memcpy(&data, &v, sizeof(data));
+    return data;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Raw
+///////////////////////////////////////////////////////////////////////////////
+
+waverror_t wav_raw_create(wavraw_t *raw, unsigned samplerate, unsigned ch, wavtype_t type, size_t frames)
+{
+    assert(raw != NULL);
+
+    raw->samplerate = samplerate;
+    raw->channels = ch;
+    raw->size = frames * ch;
+    raw->type = type;
+    raw->channelmask = 0;
+    raw->bytes = NULL;
+    if (type == TYPE_UNKNOWN) return ERROR_UNSUPPORTED;
+    if (raw->size <= 0) return ERROR_BAD_DATA;
+
+    raw->bytes = (unsigned char *)malloc(raw->size * wavtype_get_bits(type) / 8);
+    if (raw->bytes == NULL) return ERROR_MEMORY_ALLOC;
+    return ERROR_OK;
+}
+
+void wav_raw_destroy(wavraw_t *raw)
+{
+    raw->samplerate = 0;
+    raw->channels = 0;
+    raw->size = 0;
+    free(raw->bytes); raw->bytes = NULL;
+    raw->type = TYPE_UNKNOWN;
+    raw->channelmask = 0;
+}
+
+// a truncated "data" chunk yields the whole samples that are there
+waverror_t wav_read_file_raw(wavraw_t *raw, const char *filename)
+{
+    waverror_t err = ERROR_BROKEN;
+    FILE *fp = NULL;
+    size_t filesize, size, got, width;
+    long head, pos;
+    char sig[4];
+    wavdata_t fmt;
+    wavstats_t local, *stats;
+    unsigned long long start, t;
+
+    assert(raw != NULL);
+    assert(filename != NULL);
+
+    stats = stats_begin(NULL, &local);
+    start = stats_clock(stats);
+
+    raw->samplerate = 0;
+    raw->channels = 0;
+    raw->size = 0;
+    raw->bytes = NULL;
+    raw->type = TYPE_UNKNOWN;
+    raw->channelmask = 0;
+
+    t = stats_clock(stats);
+    fp = fopen(filename, "rb");
+    stats_io(stats, t);
+    if (fp == NULL) {
+        err = ERROR_UNABLE_TO_OPEN;
+        goto l_error;
+    }
+
+    err = read_header_riff(&filesize, fp);
+    if (err != ERROR_OK) { goto l_error; }
+    if (fread(sig, 1, sizeof(sig), fp) != sizeof(sig) ||
+        memcmp(sig, WAVE_HEADER, sizeof(WAVE_HEADER)) != 0) {
+        err = ERROR_NOT_WAVE;
+        goto l_error;
+    }
+    if (stats != NULL) { stats->bytes_read = 12; }
+
+    fmt.type = TYPE_UNKNOWN;
+    err = ERROR_OK;
+    while (!feof(fp) && !ferror(fp) && ftell(fp) < filesize) {
+        head = ftell(fp);
+
+        // read the chunk header
+        if (fread(sig, 1, sizeof(sig), fp) != sizeof(sig)) { break; }
+        size = read_int(fp, 4);
+        pos = ftell(fp);
+
+        if (memcmp(sig, FMT__HEADER, sizeof(FMT__HEADER)) == 0) {
+            // "fmt " chunk
+            err = read_chunk_fmt(&fmt, size, fp);
+            if (err != ERROR_OK) { goto l_error; }
+            raw->samplerate = fmt.samplerate;
+            raw->channels = fmt.channels;
+            raw->type = fmt.type;
+            raw->channelmask = fmt.channelmask;
+        }
+        else if (memcmp(sig, DATA_HEADER, sizeof(DATA_HEADER)) == 0 && size > 0) {
+            // "data" chunk, kept as it is
+            if (fmt.type == TYPE_UNKNOWN) {
+                err = ERROR_UNSUPPORTED;
+                goto l_error;
+            }
+            raw->bytes = (unsigned char *)malloc(size);
+            if (raw->bytes == NULL) {
+                err = ERROR_MEMORY_ALLOC;
+                goto l_error;
+            }
+            width = wavtype_get_bits(fmt.type) / 8;
+            t = stats_clock(stats);
+            got = fread(raw->bytes, 1, size, fp);
+            stats_io(stats, t);
+            raw->size = got / width;
+        }
+        if (stats != NULL) { stats->bytes_read += ftell(fp) - head; }
+
+        // move to the next chunk
+        t = stats_clock(stats);
+        fseek(fp, pos + size, SEEK_SET);
+        stats_io(stats, t);
+    }
+
+l_error:
+    if (fp != NULL) {
+        t = stats_clock(stats);
+        fclose(fp);
+        stats_io(stats, t);
+    }
+    if (err != ERROR_OK) { wav_raw_destroy(raw); }
+    stats_end(stats, "wav_read_file_raw", err, start);
+    return err;
+}
+
+waverror_t wav_write_file_raw(const wavraw_t *raw, const char *filename)
+{
+    waverror_t err = ERROR_UNKNOWN;
+    FILE *fp = NULL;
+    wavdata_t wave;
+    size_t bytes;
+    wavstats_t local, *stats;
+    unsigned long long start, t;
+
+    assert(raw != NULL);
+    assert(filename != NULL);
+
+    stats = stats_begin(NULL, &local);
+    start = stats_clock(stats);
+
+    // the header writers only look at the format
+    wave.samplerate = raw->samplerate;
+    wave.channels = raw->channels;
+    wave.size = raw->size;
+    wave.data = NULL;
+    wave.type = raw->type;
+    if (raw->size <= 0 || raw->bytes == NULL || raw->type == TYPE_UNKNOWN ||
+        wav_set_channelmask(&wave, raw->channelmask) != ERROR_OK ||
+        write_riff_size(&wave, NULL) > 0xFFFFFFFFULL) {
+        err = ERROR_BAD_DATA;
+        goto l_error;
+    }
+
+    t = stats_clock(stats);
+    fp = fopen(filename, "wb");
+    stats_io(stats, t);
+    if (fp == NULL) {
+        err = ERROR_UNABLE_TO_OPEN;
+        goto l_error;
+    }
+
+    err = write_header_riff(&wave, NULL, fp);
+    if (err != ERROR_OK) { goto l_error; }
+    err = write_header_fmt(&wave, NULL, fp);
+    if (err != ERROR_OK) { goto l_error; }
+
+    bytes = raw->size * wavtype_get_bits(raw->type) / 8;
+    fwrite((char *) DATA_HEADER, sizeof(DATA_HEADER), 1, fp);
+    write_int(fp, 4, (int)bytes);
+    t = stats_clock(stats);
+    fwrite(raw->bytes, 1, bytes, fp);
+    stats_io(stats, t);
+    err = ferror(fp) ? ERROR_WRITE_FAULT : ERROR_OK;
+
+l_error:
+    if (fp != NULL) {
+        if (stats != NULL) { stats->bytes_written = ftell(fp); }
+        t = stats_clock(stats);
+        fclose(fp);
+        stats_io(stats, t);
+    }
+    stats_end(stats, "wav_write_file_raw", err, start);
+    return err;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Follow
+///////////////////////////////////////////////////////////////////////////////
+
+static waverror_t follow_find_data(wavfollow_t *follow);
+static size_t follow_available(wavfollow_t *follow);
+static size_t follow_wait(wavfollow_t *follow, int timeout_ms);
+#ifdef __linux__
+static void follow_drain(wavfollow_t *follow);
+static long long follow_clock_ms(void);
+#endif
+
+waverror_t wav_follow_open(wavfollow_t *follow, const char *filename)
+{
+    waverror_t err = ERROR_BROKEN;
+    size_t filesize;
+
+    assert(follow != NULL);
+    assert(filename != NULL);
+
+    follow->fp = NULL;
+    follow->notify = -1;
+    follow->start = 0;
+    follow->offset = 0;
+    follow->samplerate = 0;
+    follow->channels = 0;
+    follow->type = TYPE_UNKNOWN;
+    follow->channelmask = 0;
+    follow->closed = 0;
+    follow->finished = 0;
+
+    follow->fp = fopen(filename, "rb");
+    if (follow->fp == NULL) {
+        err = ERROR_UNABLE_TO_OPEN;
+        goto l_error;
+    }
+
+    // RIFF header (the size is stale while the file is being recorded)
+    err = read_header_riff(&filesize, follow->fp);
+    if (err != ERROR_OK) { goto l_error; }
+
+    // WAVE header, up to the beginning of the "data" chunk
+    err = follow_find_data(follow);
+    if (err != ERROR_OK) { goto l_error; }
+
+#ifdef __linux__
+    follow->notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (follow->notify >= 0 &&
+        inotify_add_watch(follow->notify, filename, IN_MODIFY | IN_CLOSE_WRITE) < 0) {
+        close(follow->notify);
+        follow->notify = -1;
+    }
+#endif
+
+    return ERROR_OK;
+
+l_error:
+    wav_follow_close(follow);
+    return err;
+}
+
+waverror_t wav_follow_read(wavfollow_t *follow, wavdata_t *wave, int timeout_ms)
+{
+    waverror_t err;
+    size_t frames;
+    wavstats_t local, *stats;
+    unsigned long long start;
+
+    assert(follow != NULL);
+    assert(follow->fp != NULL);
+    assert(wave != NULL);
+
+    wave->samplerate = follow->samplerate;
+    wave->channels = follow->channels;
+    wave->size = 0;
+    wave->data = NULL;
+    wave->type = follow->type;
+    wavdata_set_mask(wave, follow->channelmask);
+
+    frames = follow_wait(follow, timeout_ms);
+    if (frames == 0) { return ERROR_OK; }
+
+    stats = stats_begin(NULL, &local);
+    start = stats_clock(stats);
+
+    wave->size = frames * follow->channels;
+    wave->data = buffer_new(wave->size);
+    if (wave->data == NULL) {
+        wave->size = 0;
+        err = ERROR_MEMORY_ALLOC;
+        goto l_error;
+    }
+
+    fseek(follow->fp, follow->offset, SEEK_SET);
+    err = read_chunk_data(wave, follow->fp, stats);
+    if (err != ERROR_OK) {
+        wav_destroy(wave);
+        goto l_error;
+    }
+    follow->offset += frames * follow->channels * wavtype_get_bits(follow->type) / 8;
+    if (stats != NULL) {
+        stats->bytes_read = frames * follow->channels * wavtype_get_bits(follow->type) / 8;
+    }
+
+l_error:
+    stats_end(stats, "wav_follow_read", err, start);
+    return err;
+}
+
+void wav_follow_close(wavfollow_t *follow)
+{
+    if (follow->fp != NULL) { fclose(follow->fp); follow->fp = NULL; }
+#ifdef __linux__
+    if (follow->notify >= 0) { close(follow->notify); }
+#endif
+    follow->notify = -1;
+}
+
+static waverror_t follow_find_data(wavfollow_t *follow)
+{
+    char sig[4];
+    wavdata_t fmt;
+    FILE *fp = follow->fp;
+
+    assert(fp != NULL);
+    if (feof(fp) || ferror(fp)) { return ERROR_BROKEN; }
+
+    if (fread(sig, 1, sizeof(sig), fp) != sizeof(sig) ||
+        memcmp(sig, WAVE_HEADER, sizeof(WAVE_HEADER)) != 0) {
+        return ERROR_NOT_WAVE;
+    }
+
+    fmt.type = TYPE_UNKNOWN;
+    for (;;) {
+        // read the chunk header
+        if (fread(sig, 1, sizeof(sig), fp) != sizeof(sig)) { return ERROR_BROKEN; }
+        size_t size = read_int(fp, 4);
+        long pos = ftell(fp);
+        if (feof(fp) || ferror(fp)) { return ERROR_BROKEN; }
+
+        if (memcmp(sig, FMT__HEADER, sizeof(FMT__HEADER)) == 0) {
+            // "fmt " chunk
+            waverror_t err = read_chunk_fmt(&fmt, size, fp);
+            if (err != ERROR_OK) { return err; }
+        }
+        else if (memcmp(sig, DATA_HEADER, sizeof(DATA_HEADER)) == 0) {
+            // "data" chunk: its size is ignored, the samples run to EOF
+            if (fmt.type == TYPE_UNKNOWN || fmt.channels == 0) { return ERROR_BROKEN; }
+            follow->samplerate = fmt.samplerate;
+            follow->channels = fmt.channels;
+            follow->type = fmt.type;
+            follow->channelmask = fmt.channelmask;
+            follow->start = pos;
+            follow->offset = pos;
+            return ERROR_OK;
+        }
+
+        // move to the next chunk
+        fseek(fp, pos + size, SEEK_SET);
+    }
+}
+
+// also decides whether the recording is over: the finalized "data" size
+// has been reached, or the writer closed the file and nothing is left
+static size_t follow_available(wavfollow_t *follow)
+{
+    long end;
+    unsigned long size;
+    int final = 0;
+    size_t frames;
+    size_t frame_bytes = follow->channels * wavtype_get_bits(follow->type) / 8;
+
+    // seeking also drops whatever stdio has cached from the previous EOF
+    clearerr(follow->fp);
+    if (fseek(follow->fp, 0, SEEK_END) != 0) { return 0; }
+    end = ftell(follow->fp);
+
+    // once the recorder has written the real "data" size, chunks appended
+    // after the samples (LIST, id3, ...) must not be decoded
+    if (fseek(follow->fp, follow->start - 4, SEEK_SET) == 0) {
+        size = (uint32_t)read_int(follow->fp, 4);
+        if (!feof(follow->fp) && size != 0 && (unsigned long)(end - follow->start) >= size) {
+            end = follow->start + (long)size;
+            final = 1;
+        }
+        clearerr(follow->fp);
+    }
+
+    frames = (end > follow->offset) ? (size_t)(end - follow->offset) / frame_bytes : 0;
+    follow->finished = (frames == 0 && (final || follow->closed));
+    return frames;
+}
+
+// returns the frames available, waiting up to timeout_ms (< 0: forever)
+// for the file to grow
+static size_t follow_wait(wavfollow_t *follow, int timeout_ms)
+{
+#ifdef __linux__
+    struct pollfd pfd;
+    long long deadline, left;
+    size_t frames;
+
+    // events for writes we are about to see anyway must not cut the
+    // next wait short
+    follow_drain(follow);
+    frames = follow_available(follow);
+    if (frames > 0 || follow->finished || timeout_ms == 0 || follow->notify < 0) {
+        return frames;
+    }
+
+    deadline = follow_clock_ms() + timeout_ms;
+    while (frames == 0 && !follow->finished) {
+        left = -1;
+        if (timeout_ms > 0) {
+            left = deadline - follow_clock_ms();
+            if (left <= 0) { break; }
+        }
+
+        pfd.fd = follow->notify;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, (int)left) <= 0) { break; }
+
+        // a write may end in the middle of a frame: keep waiting
+        follow_drain(follow);
+        frames = follow_available(follow);
+    }
+    return frames;
+#else
+    (void)timeout_ms;
+    return follow_available(follow);
+#endif
+}
+
+#ifdef __linux__
+static void follow_drain(wavfollow_t *follow)
+{
+    char events[4096];
+    struct inotify_event ev;
+    ssize_t n, p;
+    if (follow->notify < 0) { return; }
+
+    // the file counts as closed until somebody writes to it again
+    while ((n = read(follow->notify, events, sizeof(events))) > 0) {
+        for (p = 0; p + (ssize_t)sizeof(ev) <= n; p += sizeof(ev) + ev.len) {
+            memcpy(&ev, events + p, sizeof(ev));
+            if (ev.mask & IN_CLOSE_WRITE) { follow->closed = 1; }
+            else if (ev.mask & IN_MODIFY) { follow->closed = 0; }
+        }
+    }
+}
+
+static long long follow_clock_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
+#endif
@@ -23,6 +23,11 @@
 #define __MINIWAV_H__
 
 #include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef enum waverror {
     ERROR_OK,
@@ -45,7 +50,8 @@ typedef enum wavtype {
     TYPE_INT16,
     TYPE_INT24,
     TYPE_INT32,
-    TYPE_FLOAT
+    TYPE_FLOAT,
+    TYPE_DOUBLE
 } wavtype_t;
 
 typedef struct wavdata {
@@ -54,11 +60,93 @@ typedef struct wavdata {
     size_t size;
     double *data;
     wavtype_t type;
+    // speaker positions, 0 if unspecified; set with wav_set_channelmask(),
+    // a value assigned directly is ignored
+    unsigned channelmask;
+    unsigned channelmask_tag;
 } wavdata_t;
 
+// the "data" chunk as stored in the file, for callers with their own codecs
+typedef struct wavraw {
+    unsigned samplerate;
+    unsigned channels;
+    size_t size;                    // samples (frames * channels)
+    unsigned char *bytes;           // size * bits / 8 bytes, little-endian
+    wavtype_t type;
+    unsigned channelmask;
+} wavraw_t;
+
+typedef struct wavfollow {
+    FILE *fp;
+    int notify;
+    long start;
+    long offset;
+    unsigned samplerate;
+    unsigned channels;
+    wavtype_t type;
+    unsigned channelmask;
+    int closed;                     // the last writer closed the file
+    int finished;                   // no more frames will come
+} wavfollow_t;
+
+typedef struct wavresampler {
+    unsigned samplerate;            // output sampling rate
+    unsigned channels;
+    unsigned up, down;              // output/input rate ratio in lowest terms
+    unsigned taps;                  // input frames per output frame
+    unsigned long long delay;       // filter delay at the upsampled rate
+    unsigned long long frames;      // input frames given to process
+    unsigned long long fed;         // input frames filtered, padding included
+    unsigned long long produced;    // output frames
+    double *coefs;                  // one time-reversed filter per phase
+    double *work;                   // planar history + current chunk
+} wavresampler_t;
+
+typedef struct wavstats {
+    size_t bytes_read;              // file bytes consumed
+    size_t bytes_written;           // file bytes produced
+    size_t io_calls;                // open/close/seek and block read/write calls
+    size_t clipped;                 // samples clipped to [-1, +1] on write
+    unsigned long long ns_parse;    // header parsing and everything else
+    unsigned long long ns_convert;  // sample conversion
+    unsigned long long ns_io;       // file I/O
+} wavstats_t;
+
+typedef void (*wavstats_callback_t)(const char *func, waverror_t result,
+                                    const wavstats_t *stats, void *user);
+
 waverror_t wav_create(wavdata_t *wave, unsigned samplerate, unsigned ch, size_t frames);
 void wav_destroy(wavdata_t *wave);
+waverror_t wav_set_channelmask(wavdata_t *wave, unsigned mask);
 waverror_t wav_read_file(wavdata_t *wave, const char *filename);
 waverror_t wav_write_file(const wavdata_t *wave, const char *filename);
 
+waverror_t wav_write_file_direct(const wavdata_t *wave, const char *filename);
+
+waverror_t wav_read_file_resampled(wavdata_t *wave, const char *filename, unsigned samplerate);
+waverror_t wav_write_file_resampled(const wavdata_t *wave, const char *filename, unsigned samplerate);
+
+waverror_t wav_resampler_create(wavresampler_t *rs, unsigned from, unsigned to, unsigned ch);
+void wav_resampler_destroy(wavresampler_t *rs);
+size_t wav_resampler_max_output(const wavresampler_t *rs, size_t frames);
+size_t wav_resampler_process(wavresampler_t *rs, const double *in, size_t frames, double *out);
+size_t wav_resampler_flush(wavresampler_t *rs, double *out);
+
+void wav_set_stats_callback(wavstats_callback_t callback, void *user);
+waverror_t wav_read_file_stats(wavdata_t *wave, const char *filename, wavstats_t *stats);
+waverror_t wav_write_file_stats(const wavdata_t *wave, const char *filename, wavstats_t *stats);
+
+waverror_t wav_raw_create(wavraw_t *raw, unsigned samplerate, unsigned ch, wavtype_t type, size_t frames);
+void wav_raw_destroy(wavraw_t *raw);
+waverror_t wav_read_file_raw(wavraw_t *raw, const char *filename);
+waverror_t wav_write_file_raw(const wavraw_t *raw, const char *filename);
+
+waverror_t wav_follow_open(wavfollow_t *follow, const char *filename);
+waverror_t wav_follow_read(wavfollow_t *follow, wavdata_t *wave, int timeout_ms);
+void wav_follow_close(wavfollow_t *follow);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
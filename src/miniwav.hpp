@@ -0,0 +1,653 @@
+/*
+    miniwav : A quick & dirty C library for reading/writing WAV audio file.
+    Copyright (C) 2017 mogesystem
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+       claim that you wrote the original software. If you use this software
+       in a product, an acknowledgment in the product documentation would be
+       appreciated but is not required.
+    2. Altered source versions must be plainly marked as such, and must not be
+       misrepresented as being the original software.
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef __MINIWAV_HPP__
+#define __MINIWAV_HPP__
+
+#include "miniwav.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+namespace miniwav {
+
+///////////////////////////////////////////////////////////////////////////////
+// Sample codecs (same scaling as miniwav.c)
+///////////////////////////////////////////////////////////////////////////////
+
+template <wavtype_t Type> struct sample_traits;
+
+namespace detail {
+    inline double limit(double sig)
+    {
+        if (sig > +1.0) { return +1.0; }
+        if (sig < -1.0) { return -1.0; }
+        return sig;
+    }
+
+    template <std::size_t Bytes>
+    inline std::int32_t load_int(const std::uint8_t *p)
+    {
+        std::uint32_t value = 0;
+        for (std::size_t i = 0; i < Bytes; i++) {
+            value |= std::uint32_t(p[i]) << (i * 8);
+        }
+        return std::int32_t(value);
+    }
+
+    template <std::size_t Bytes>
+    inline void store_int(std::uint8_t *p, std::int32_t value)
+    {
+        for (std::size_t i = 0; i < Bytes; i++) {
+            p[i] = std::uint8_t(std::uint32_t(value) >> (i * 8));
+        }
+    }
+}
+
+template <> struct sample_traits<TYPE_UINT8> {
+    static constexpr std::size_t bytes = 1;
+    static double decode(const std::uint8_t *p) { return (p[0] - 128.0) / 127.0; }
+    static void encode(double sig, std::uint8_t *p) {
+        p[0] = std::uint8_t(int(detail::limit(sig) * 127) + 128);
+    }
+};
+
+template <> struct sample_traits<TYPE_INT16> {
+    static constexpr std::size_t bytes = 2;
+    static double decode(const std::uint8_t *p) {
+        return std::int16_t(detail::load_int<2>(p)) / 32767.0;
+    }
+    static void encode(double sig, std::uint8_t *p) {
+        detail::store_int<2>(p, int(detail::limit(sig) * 32767));
+    }
+};
+
+template <> struct sample_traits<TYPE_INT24> {
+    static constexpr std::size_t bytes = 3;
+    static double decode(const std::uint8_t *p) {
+        std::int32_t data = detail::load_int<3>(p);
+        return ((data & 0x7fffff) - (data & 0x800000)) / 8388607.0;
+    }
+    static void encode(double sig, std::uint8_t *p) {
+        detail::store_int<3>(p, int(detail::limit(sig) * 8388607));
+    }
+};
+
+template <> struct sample_traits<TYPE_INT32> {
+    static constexpr std::size_t bytes = 4;
+    static double decode(const std::uint8_t *p) {
+        return detail::load_int<4>(p) / 2147483647.0;
+    }
+    static void encode(double sig, std::uint8_t *p) {
+        detail::store_int<4>(p, int(detail::limit(sig) * 2147483647));
+    }
+};
+
+template <> struct sample_traits<TYPE_FLOAT> {
+    static constexpr std::size_t bytes = 4;
+    static double decode(const std::uint8_t *p) {
+        float data;
+        std::memcpy(&data, p, sizeof(data));
+        return double(data);
+    }
+    static void encode(double sig, std::uint8_t *p) {
+        float data = float(sig);
+        std::memcpy(p, &data, sizeof(data));
+    }
+};
+
+// little-endian regardless of the host, like load_double/store_double
+template <> struct sample_traits<TYPE_DOUBLE> {
+    static constexpr std::size_t bytes = 8;
+    static double decode(const std::uint8_t *p) {
+        std::uint64_t v = 0;
+        double data;
+        for (std::size_t i = 0; i < bytes; i++) {
+            v |= std::uint64_t(p[i]) << (i * 8);
+        }
+        std::memcpy(&data, &v, sizeof(data));
+        return data;
+    }
+    static void encode(double sig, std::uint8_t *p) {
+        std::uint64_t v;
+        std::memcpy(&v, &sig, sizeof(v));
+        for (std::size_t i = 0; i < bytes; i++) {
+            p[i] = std::uint8_t(v >> (i * 8));
+        }
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Conversion kernels
+//
+// The sample type and the channel count are template parameters, so each
+// instantiation is a flat loop with no per-sample dispatch.
+///////////////////////////////////////////////////////////////////////////////
+
+// encoded bytes -> double; returns the number of frames converted
+template <wavtype_t Type, unsigned Channels>
+std::size_t decode(std::span<const std::uint8_t> in, std::span<double> out)
+{
+    using traits = sample_traits<Type>;
+    static_assert(Channels > 0, "Channels must be positive");
+    const std::size_t frames = std::min(
+        in.size() / (traits::bytes * Channels), out.size() / Channels);
+    const std::uint8_t *src = in.data();
+    double *dst = out.data();
+
+    for (std::size_t i = 0; i < frames; i++) {
+        for (unsigned c = 0; c < Channels; c++) {
+            dst[c] = traits::decode(src + c * traits::bytes);
+        }
+        src += traits::bytes * Channels;
+        dst += Channels;
+    }
+    return frames;
+}
+
+// double -> encoded bytes; returns the number of frames converted
+template <wavtype_t Type, unsigned Channels>
+std::size_t encode(std::span<const double> in, std::span<std::uint8_t> out)
+{
+    using traits = sample_traits<Type>;
+    static_assert(Channels > 0, "Channels must be positive");
+    const std::size_t frames = std::min(
+        in.size() / Channels, out.size() / (traits::bytes * Channels));
+    const double *src = in.data();
+    std::uint8_t *dst = out.data();
+
+    for (std::size_t i = 0; i < frames; i++) {
+        for (unsigned c = 0; c < Channels; c++) {
+            traits::encode(src[c], dst + c * traits::bytes);
+        }
+        src += Channels;
+        dst += traits::bytes * Channels;
+    }
+    return frames;
+}
+
+// encoded bytes -> encoded bytes of another type; returns frames converted
+template <wavtype_t From, wavtype_t To, unsigned Channels>
+std::size_t convert(std::span<const std::uint8_t> in, std::span<std::uint8_t> out)
+{
+    using from = sample_traits<From>;
+    using to = sample_traits<To>;
+    static_assert(Channels > 0, "Channels must be positive");
+    const std::size_t frames = std::min(
+        in.size() / (from::bytes * Channels), out.size() / (to::bytes * Channels));
+    const std::uint8_t *src = in.data();
+    std::uint8_t *dst = out.data();
+
+    for (std::size_t i = 0; i < frames * Channels; i++) {
+        to::encode(from::decode(src), dst);
+        src += from::bytes;
+        dst += to::bytes;
+    }
+    return frames;
+}
+
+// calls f(std::integral_constant<wavtype_t, T>{}) for a runtime type;
+// returns false if the type is unknown
+template <class F>
+bool dispatch(wavtype_t type, F &&f)
+{
+    switch (type) {
+    case TYPE_UINT8: f(std::integral_constant<wavtype_t, TYPE_UINT8>{}); return true;
+    case TYPE_INT16: f(std::integral_constant<wavtype_t, TYPE_INT16>{}); return true;
+    case TYPE_INT24: f(std::integral_constant<wavtype_t, TYPE_INT24>{}); return true;
+    case TYPE_INT32: f(std::integral_constant<wavtype_t, TYPE_INT32>{}); return true;
+    case TYPE_FLOAT: f(std::integral_constant<wavtype_t, TYPE_FLOAT>{}); return true;
+    case TYPE_DOUBLE: f(std::integral_constant<wavtype_t, TYPE_DOUBLE>{}); return true;
+    default:         return false;
+    }
+}
+
+namespace detail {
+    // interleaved samples of any channel count; mono and stereo get their
+    // own instantiation, other layouts go through the mono loop (the codecs
+    // don't depend on the channel); return the number of samples converted
+    template <wavtype_t Type>
+    std::size_t decode_samples(std::span<const std::uint8_t> in, std::span<double> out, unsigned ch)
+    {
+        if (ch == 2) { return decode<Type, 2>(in, out) * 2; }
+        return decode<Type, 1>(in, out);
+    }
+
+    template <wavtype_t Type>
+    std::size_t encode_samples(std::span<const double> in, std::span<std::uint8_t> out, unsigned ch)
+    {
+        if (ch == 2) { return encode<Type, 2>(in, out) * 2; }
+        return encode<Type, 1>(in, out);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// raw: owns a wavraw_t, the "data" chunk as stored in the file (move-only)
+///////////////////////////////////////////////////////////////////////////////
+
+class raw {
+public:
+    raw() noexcept : m_raw() {}
+    ~raw() { reset(); }
+
+    raw(const raw &) = delete;
+    raw &operator=(const raw &) = delete;
+
+    raw(raw &&other) noexcept : m_raw(other.release()) {}
+    raw &operator=(raw &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            m_raw = other.release();
+        }
+        return *this;
+    }
+
+    waverror_t create(unsigned samplerate, unsigned ch, wavtype_t type, std::size_t frames)
+    {
+        wavraw_t r = wavraw_t();
+        waverror_t err = wav_raw_create(&r, samplerate, ch, type, frames);
+        if (err != ERROR_OK) { wav_raw_destroy(&r); return err; }
+        reset();
+        m_raw = r;
+        return ERROR_OK;
+    }
+
+    waverror_t read(const char *filename)
+    {
+        wavraw_t r = wavraw_t();
+        waverror_t err = wav_read_file_raw(&r, filename);
+        if (err != ERROR_OK) { return err; }
+        reset();
+        m_raw = r;
+        return ERROR_OK;
+    }
+
+    waverror_t write(const char *filename) const
+    {
+        return wav_write_file_raw(&m_raw, filename);
+    }
+
+    void reset() noexcept
+    {
+        wav_raw_destroy(&m_raw);
+        m_raw = wavraw_t();
+    }
+
+    // gives up ownership; the caller must wav_raw_destroy() the result
+    wavraw_t release() noexcept
+    {
+        wavraw_t r = m_raw;
+        m_raw = wavraw_t();
+        return r;
+    }
+
+    wavraw_t *get() noexcept { return &m_raw; }
+    const wavraw_t *get() const noexcept { return &m_raw; }
+
+    unsigned samplerate() const noexcept { return m_raw.samplerate; }
+    unsigned channels() const noexcept { return m_raw.channels; }
+    wavtype_t type() const noexcept { return m_raw.type; }
+    unsigned channelmask() const noexcept { return m_raw.channelmask; }
+    void set_channelmask(unsigned mask) noexcept { m_raw.channelmask = mask; }
+    std::size_t frames() const noexcept
+    {
+        return (m_raw.channels > 0) ? (m_raw.size / m_raw.channels) : 0;
+    }
+    bool empty() const noexcept { return m_raw.size == 0; }
+
+    // the encoded samples, for decode/encode/convert
+    std::span<std::uint8_t> bytes() noexcept { return { m_raw.bytes, size_bytes() }; }
+    std::span<const std::uint8_t> bytes() const noexcept { return { m_raw.bytes, size_bytes() }; }
+
+private:
+    std::size_t size_bytes() const noexcept
+    {
+        switch (m_raw.type) {
+        case TYPE_UINT8:  return m_raw.size;
+        case TYPE_INT16:  return m_raw.size * 2;
+        case TYPE_INT24:  return m_raw.size * 3;
+        case TYPE_INT32:  return m_raw.size * 4;
+        case TYPE_FLOAT:  return m_raw.size * 4;
+        case TYPE_DOUBLE: return m_raw.size * 8;
+        default:          return 0;
+        }
+    }
+
+    wavraw_t m_raw;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// buffer: owns a wavdata_t (move-only)
+///////////////////////////////////////////////////////////////////////////////
+
+class buffer {
+public:
+    buffer() noexcept : m_wave() {}
+    explicit buffer(wavdata_t wave) noexcept : m_wave(wave) {}
+    ~buffer() { reset(); }
+
+    buffer(const buffer &) = delete;
+    buffer &operator=(const buffer &) = delete;
+
+    buffer(buffer &&other) noexcept : m_wave(other.release()) {}
+    buffer &operator=(buffer &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            m_wave = other.release();
+        }
+        return *this;
+    }
+
+    waverror_t create(unsigned samplerate, unsigned ch, std::size_t frames)
+    {
+        wavdata_t wave = wavdata_t();
+        waverror_t err = wav_create(&wave, samplerate, ch, frames);
+        if (err != ERROR_OK) { wav_destroy(&wave); return err; }
+        reset();
+        m_wave = wave;
+        return ERROR_OK;
+    }
+
+    // decoded by the kernel specialized for the file's sample type; a
+    // truncated "data" chunk yields the whole frames that are there
+    waverror_t read(const char *filename)
+    {
+        raw file;
+        waverror_t err = file.read(filename);
+        if (err != ERROR_OK) { return err; }
+        return decode_from(file);
+    }
+
+    waverror_t decode_from(const raw &file)
+    {
+        wavdata_t wave = wavdata_t();
+        wave.samplerate = file.samplerate();
+        wave.channels = file.channels();
+        if (!file.empty()) {
+            waverror_t err = wav_create(&wave, file.samplerate(), file.channels(), file.frames());
+            if (err != ERROR_OK) { wav_destroy(&wave); return err; }
+        }
+        wave.type = file.type();
+        wav_set_channelmask(&wave, file.channelmask());
+
+        dispatch(wave.type, [&](auto tag) {
+            detail::decode_samples<decltype(tag)::value>(
+                file.bytes(), std::span<double>(wave.data, wave.size), wave.channels);
+        });
+        reset();
+        m_wave = wave;
+        return ERROR_OK;
+    }
+
+    // resampled to samplerate while decoding
+    waverror_t read(const char *filename, unsigned samplerate)
+    {
+        wavdata_t wave = wavdata_t();
+        waverror_t err = wav_read_file_resampled(&wave, filename, samplerate);
+        if (err != ERROR_OK) { wav_destroy(&wave); return err; }
+        reset();
+        m_wave = wave;
+        return ERROR_OK;
+    }
+
+    // encoded by the kernel specialized for type()
+    waverror_t write(const char *filename) const
+    {
+        raw file;
+        waverror_t err = encode_to(file);
+        if (err != ERROR_OK) { return err; }
+        return file.write(filename);
+    }
+
+    waverror_t encode_to(raw &file) const
+    {
+        raw out;
+        waverror_t err = out.create(samplerate(), channels(), type(), frames());
+        if (err != ERROR_OK) { return err; }
+        out.set_channelmask(channelmask());
+
+        dispatch(type(), [&](auto tag) {
+            detail::encode_samples<decltype(tag)::value>(
+                samples().first(frames() * channels()), out.bytes(), channels());
+        });
+        file = std::move(out);
+        return ERROR_OK;
+    }
+
+    // O_DIRECT, bypassing the page cache where the filesystem allows it
+    waverror_t write_direct(const char *filename) const
+    {
+        return wav_write_file_direct(&m_wave, filename);
+    }
+
+    // resampled to samplerate before encoding
+    waverror_t write(const char *filename, unsigned samplerate) const
+    {
+        return wav_write_file_resampled(&m_wave, filename, samplerate);
+    }
+
+    void reset() noexcept
+    {
+        wav_destroy(&m_wave);
+        m_wave = wavdata_t();
+    }
+
+    // gives up ownership; the caller must wav_destroy() the result
+    wavdata_t release() noexcept
+    {
+        wavdata_t wave = m_wave;
+        m_wave = wavdata_t();
+        return wave;
+    }
+
+    wavdata_t *get() noexcept { return &m_wave; }
+    const wavdata_t *get() const noexcept { return &m_wave; }
+
+    unsigned samplerate() const noexcept { return m_wave.samplerate; }
+    unsigned channels() const noexcept { return m_wave.channels; }
+    wavtype_t type() const noexcept { return m_wave.type; }
+    void set_type(wavtype_t type) noexcept { m_wave.type = type; }
+    unsigned channelmask() const noexcept { return m_wave.channelmask; }
+    waverror_t set_channelmask(unsigned mask) noexcept { return wav_set_channelmask(&m_wave, mask); }
+    std::size_t frames() const noexcept
+    {
+        return (m_wave.channels > 0) ? (m_wave.size / m_wave.channels) : 0;
+    }
+    bool empty() const noexcept { return m_wave.size == 0; }
+
+    // interleaved samples
+    std::span<double> samples() noexcept { return { m_wave.data, m_wave.size }; }
+    std::span<const double> samples() const noexcept { return { m_wave.data, m_wave.size }; }
+
+    // one frame (all channels of sample i)
+    std::span<double> frame(std::size_t i) noexcept
+    {
+        return samples().subspan(i * m_wave.channels, m_wave.channels);
+    }
+    std::span<const double> frame(std::size_t i) const noexcept
+    {
+        return samples().subspan(i * m_wave.channels, m_wave.channels);
+    }
+
+    // one frame with a compile-time channel count (must match channels())
+    template <unsigned Channels>
+    std::span<double, Channels> frame(std::size_t i) noexcept
+    {
+        assert(Channels == channels());
+        assert(i < frames());
+        return std::span<double, Channels>(m_wave.data + i * Channels, Channels);
+    }
+    template <unsigned Channels>
+    std::span<const double, Channels> frame(std::size_t i) const noexcept
+    {
+        assert(Channels == channels());
+        assert(i < frames());
+        return std::span<const double, Channels>(m_wave.data + i * Channels, Channels);
+    }
+
+private:
+    wavdata_t m_wave;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// resampler: owns a wavresampler_t (move-only)
+///////////////////////////////////////////////////////////////////////////////
+
+class resampler {
+public:
+    resampler() noexcept : m_rs() {}
+    ~resampler() { reset(); }
+
+    resampler(const resampler &) = delete;
+    resampler &operator=(const resampler &) = delete;
+
+    resampler(resampler &&other) noexcept : m_rs(other.m_rs) { other.m_rs = wavresampler_t(); }
+    resampler &operator=(resampler &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            m_rs = other.m_rs;
+            other.m_rs = wavresampler_t();
+        }
+        return *this;
+    }
+
+    waverror_t create(unsigned from, unsigned to, unsigned ch)
+    {
+        reset();
+        waverror_t err = wav_resampler_create(&m_rs, from, to, ch);
+        if (err != ERROR_OK) { m_rs = wavresampler_t(); }
+        return err;
+    }
+
+    void reset() noexcept
+    {
+        wav_resampler_destroy(&m_rs);
+        m_rs = wavresampler_t();
+    }
+
+    bool is_open() const noexcept { return m_rs.coefs != nullptr; }
+    unsigned samplerate() const noexcept { return m_rs.samplerate; }
+    unsigned channels() const noexcept { return m_rs.channels; }
+
+    // output frames one process(in) of this many frames may return
+    std::size_t max_output(std::size_t frames) const noexcept
+    {
+        return wav_resampler_max_output(&m_rs, frames);
+    }
+
+    // interleaved frames in, interleaved frames out; returns output frames
+    std::size_t process(std::span<const double> in, std::span<double> out) noexcept
+    {
+        std::size_t frames = in.size() / m_rs.channels;
+        assert(is_open());
+        assert(out.size() >= max_output(frames) * m_rs.channels);
+        return wav_resampler_process(&m_rs, in.data(), frames, out.data());
+    }
+
+    std::size_t flush(std::span<double> out) noexcept
+    {
+        assert(is_open());
+        assert(out.size() >= max_output(m_rs.taps) * m_rs.channels);
+        return wav_resampler_flush(&m_rs, out.data());
+    }
+
+    wavresampler_t *get() noexcept { return &m_rs; }
+    const wavresampler_t *get() const noexcept { return &m_rs; }
+
+private:
+    wavresampler_t m_rs;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// follower: owns a wavfollow_t (move-only)
+///////////////////////////////////////////////////////////////////////////////
+
+class follower {
+public:
+    follower() noexcept { clear(); }
+    ~follower() { close(); }
+
+    follower(const follower &) = delete;
+    follower &operator=(const follower &) = delete;
+
+    follower(follower &&other) noexcept : m_follow(other.m_follow) { other.clear(); }
+    follower &operator=(follower &&other) noexcept
+    {
+        if (this != &other) {
+            close();
+            m_follow = other.m_follow;
+            other.clear();
+        }
+        return *this;
+    }
+
+    waverror_t open(const char *filename)
+    {
+        close();
+        waverror_t err = wav_follow_open(&m_follow, filename);
+        if (err != ERROR_OK) { clear(); }
+        return err;
+    }
+
+    // replaces out with the frames appended since the last call
+    waverror_t read(buffer &out, int timeout_ms)
+    {
+        wavdata_t wave = wavdata_t();
+        waverror_t err = wav_follow_read(&m_follow, &wave, timeout_ms);
+        out = buffer(wave);
+        return err;
+    }
+
+    void close() noexcept
+    {
+        if (is_open()) { wav_follow_close(&m_follow); }
+        clear();
+    }
+
+    bool is_open() const noexcept { return m_follow.fp != nullptr; }
+    unsigned samplerate() const noexcept { return m_follow.samplerate; }
+    unsigned channels() const noexcept { return m_follow.channels; }
+    wavtype_t type() const noexcept { return m_follow.type; }
+    unsigned channelmask() const noexcept { return m_follow.channelmask; }
+    // no more frames will come (see wavfollow_t.finished)
+    bool finished() const noexcept { return m_follow.finished != 0; }
+
+private:
+    void clear() noexcept
+    {
+        m_follow = wavfollow_t();
+        m_follow.notify = -1;
+    }
+
+    wavfollow_t m_follow;
+};
+
+} // namespace miniwav
+
+#endif
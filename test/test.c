@@ -19,12 +19,24 @@
     3. This notice may not be removed or altered from any source distribution.
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
 #include "miniwav.h"
 
+#ifdef __linux__
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
 // error messages
 static char *error_messages[256];
 static void init_error_messages()
@@ -120,6 +132,8 @@ static void verifyfile(const char *filename,
         e
     );
     fflush(stdout);
+
+    wav_destroy(&wave);
 }
 
 static void verifyfiles(const char *prefix,
@@ -130,7 +144,7 @@ static void verifyfiles(const char *prefix,
     char filename[120];
     assert(prefix != NULL);
 
-    for (i = (int)TYPE_UINT8; i <= (int)TYPE_FLOAT; i++) {
+    for (i = (int)TYPE_UINT8; i <= (int)TYPE_DOUBLE; i++) {
         sprintf(filename, "%s_%d.wav", prefix, i);
         verifyfile(filename, size, orig, threshold);
     }
@@ -156,7 +170,7 @@ static void writefiles(wavdata_t w, const char *prefix)
     char filename[120];
     assert(prefix != NULL);
 
-    for (i = (int)TYPE_UINT8; i <= (int)TYPE_FLOAT; i++) {
+    for (i = (int)TYPE_UINT8; i <= (int)TYPE_DOUBLE; i++) {
         sprintf(filename, "%s_%d.wav", prefix, i);
         writefile(w, filename, (wavtype_t)i);
     }
@@ -199,12 +213,581 @@ void test_read_write_verify()
     TEST_DONE;
 }
 
+static void write_le32(FILE *fp, size_t value)
+{
+    int i;
+    for (i = 0; i < 4; i++) { fputc((int)(value >> (i * 8)) & 0xff, fp); }
+}
+
+#ifdef __linux__
+static long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+#endif
+
+void test_follow()
+{
+    wavdata_t wave, part;
+    wavfollow_t follow;
+    waverror_t result;
+    FILE *src, *dst;
+    char header[44];
+    size_t half, bytes, tail = 1000;
+    char *body;
+    static const char list[12] = { 'L', 'I', 'S', 'T', 4, 0, 0, 0, 'I', 'N', 'F', 'O' };
+    TEST_START;
+
+    // simulate a recorder: stale sizes in the header, data appended later
+    wave = readfile("output/sine_2.wav");
+    src = fopen("output/sine_2.wav", "rb");
+    assert(src != NULL);
+    assert(fread(header, 1, sizeof(header), src) == sizeof(header));
+    bytes = wave.size * 2;
+    body = (char *)malloc(bytes);
+    assert(body != NULL);
+    assert(fread(body, 1, bytes, src) == bytes);
+    fclose(src);
+
+    memset(header + 4, 0, 4);
+    memset(header + 40, 0, 4);
+    half = bytes / 2 + 1;   // cut in the middle of a sample
+
+    dst = fopen("output/follow.wav", "wb");
+    assert(dst != NULL);
+    fwrite(header, 1, sizeof(header), dst);
+    fwrite(body, 1, half, dst);
+    fflush(dst);
+
+    result = wav_follow_open(&follow, "output/follow.wav");
+    printf("follow:\topen: "); show_result(result);
+    assert(result == ERROR_OK);
+
+    result = wav_follow_read(&follow, &part, 0);
+    assert(result == ERROR_OK);
+    printf("follow:\tread %d / %d samples\n", (int)part.size, (int)wave.size);
+    assert(part.size == half / 2 && !follow.finished);
+    assert(memcmp(part.data, wave.data, part.size * sizeof(double)) == 0);
+    wav_destroy(&part);
+
+    fwrite(body + half, 1, bytes - tail - half, dst);
+    fflush(dst);
+
+    result = wav_follow_read(&follow, &part, 100);
+    assert(result == ERROR_OK);
+    printf("follow:\tread %d / %d samples\n", (int)part.size, (int)wave.size);
+    assert(part.size == (bytes - tail) / 2 - half / 2);
+    assert(memcmp(part.data, wave.data + half / 2, part.size * sizeof(double)) == 0);
+    wav_destroy(&part);
+
+#ifdef __linux__
+    {
+        long long t;
+        pid_t pid;
+
+        // the events of the writes above must not end this wait early
+        t = now_ms();
+        result = wav_follow_read(&follow, &part, 200);
+        t = now_ms() - t;
+        printf("follow:\tno data, waited %d ms\n", (int)t);
+        assert(result == ERROR_OK && part.size == 0);
+        assert(t >= 150);
+
+        // woken up by inotify when another process appends
+        pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            FILE *fp;
+            usleep(50 * 1000);
+            fp = fopen("output/follow.wav", "ab");
+            fwrite(body + bytes - tail, 1, tail, fp);
+            fclose(fp);
+            _exit(0);
+        }
+        t = now_ms();
+        result = wav_follow_read(&follow, &part, 5000);
+        t = now_ms() - t;
+        waitpid(pid, NULL, 0);
+        printf("follow:\tread %d samples after %d ms\n", (int)part.size, (int)t);
+        assert(result == ERROR_OK);
+        assert(part.size == tail / 2);
+        assert(t < 2000);
+    }
+#else
+    fwrite(body + bytes - tail, 1, tail, dst);
+    fflush(dst);
+    result = wav_follow_read(&follow, &part, 0);
+    assert(result == ERROR_OK && part.size == tail / 2);
+#endif
+    assert(memcmp(part.data, wave.data + wave.size - tail / 2, part.size * sizeof(double)) == 0);
+    wav_destroy(&part);
+
+    // the recorder finalizes the header and appends a trailing chunk
+    fseek(dst, 4, SEEK_SET);
+    write_le32(dst, 36 + bytes + sizeof(list));
+    fseek(dst, 40, SEEK_SET);
+    write_le32(dst, bytes);
+    fseek(dst, 0, SEEK_END);
+    fwrite(list, 1, sizeof(list), dst);
+    fflush(dst);
+
+    // no more frames will come: even an endless wait returns
+    result = wav_follow_read(&follow, &part, -1);
+    printf("follow:\tfinalized: %d samples, finished %d\n", (int)part.size, follow.finished);
+    assert(result == ERROR_OK && part.size == 0 && follow.finished);
+    wav_follow_close(&follow);
+
+#ifdef __linux__
+    // a recorder that never writes the sizes is done when it closes the file
+    src = fopen("output/follow_closed.wav", "wb");
+    assert(src != NULL);
+    fwrite(header, 1, sizeof(header), src);
+    fwrite(body, 1, bytes, src);
+    fflush(src);
+    result = wav_follow_open(&follow, "output/follow_closed.wav");
+    assert(result == ERROR_OK);
+    result = wav_follow_read(&follow, &part, 0);
+    assert(result == ERROR_OK && part.size == wave.size && !follow.finished);
+    wav_destroy(&part);
+    fclose(src);
+    result = wav_follow_read(&follow, &part, -1);
+    printf("follow:\tclosed: %d samples, finished %d\n", (int)part.size, follow.finished);
+    assert(result == ERROR_OK && part.size == 0 && follow.finished);
+    wav_follow_close(&follow);
+#endif
+
+    // following a finished file stops at the end of the "data" chunk
+    result = wav_follow_open(&follow, "output/follow.wav");
+    assert(result == ERROR_OK);
+    result = wav_follow_read(&follow, &part, 0);
+    assert(result == ERROR_OK);
+    printf("follow:\tfinished file: %d / %d samples\n", (int)part.size, (int)wave.size);
+    assert(part.size == wave.size);
+    assert(memcmp(part.data, wave.data, part.size * sizeof(double)) == 0);
+    wav_destroy(&part);
+    result = wav_follow_read(&follow, &part, -1);
+    assert(result == ERROR_OK && part.size == 0 && follow.finished);
+    wav_follow_close(&follow);
+
+    fclose(dst);
+    free(body);
+    wav_destroy(&wave);
+    TEST_DONE;
+}
+
+static int stats_calls;
+static char stats_func[64];
+static void count_stats(const char *func, waverror_t result,
+                        const wavstats_t *stats, void *user)
+{
+    assert(func != NULL && stats != NULL);
+    (void)result;
+    *(int *)user += 1;
+    snprintf(stats_func, sizeof(stats_func), "%s", func);
+}
+
+void test_stats()
+{
+    int i;
+    wavdata_t wave, copy;
+    wavstats_t stats;
+    waverror_t result;
+    FILE *src, *dst;
+    char head[44 + 1001];
+    TEST_START;
+
+    result = wav_create(&wave, 44100/*Hz*/, 1/*ch*/, 44100/*frames*/);
+    assert(result == ERROR_OK);
+    for (i = 0; i < wave.size; i++) {
+        wave.data[i] = sin(i * M_PI / 180.0) * 1.5;
+    }
+
+    result = wav_write_file_stats(&wave, "output/stats.wav", &stats);
+    assert(result == ERROR_OK);
+    printf(
+        "stats:\twrite: %d bytes, %d calls, %d clipped, "
+        "parse %llu ns, convert %llu ns, io %llu ns\n",
+        (int)stats.bytes_written, (int)stats.io_calls, (int)stats.clipped,
+        stats.ns_parse, stats.ns_convert, stats.ns_io
+    );
+    assert(stats.bytes_written == 44 + wave.size * 2);
+    assert(stats.clipped > 0 && stats.clipped < wave.size);
+
+    result = wav_read_file_stats(&copy, "output/stats.wav", &stats);
+    assert(result == ERROR_OK);
+    printf(
+        "stats:\tread: %d bytes, %d calls, "
+        "parse %llu ns, convert %llu ns, io %llu ns\n",
+        (int)stats.bytes_read, (int)stats.io_calls,
+        stats.ns_parse, stats.ns_convert, stats.ns_io
+    );
+    assert(stats.bytes_read == 44 + wave.size * 2);
+    assert(stats.io_calls > 0);
+
+    // a truncated file: only the bytes actually there were read
+    wav_destroy(&copy);
+    src = fopen("output/stats.wav", "rb");
+    dst = fopen("output/stats_cut.wav", "wb");
+    assert(src != NULL && dst != NULL);
+    assert(fread(head, 1, sizeof(head), src) == sizeof(head));
+    fwrite(head, 1, sizeof(head), dst);
+    fclose(src);
+    fclose(dst);
+    result = wav_read_file_stats(&copy, "output/stats_cut.wav", &stats);
+    assert(result == ERROR_OK);
+    printf("stats:	truncated read: %d bytes\n", (int)stats.bytes_read);
+    assert(stats.bytes_read == 44 + 1001);
+    wav_destroy(&copy);
+
+    // callbacks see the plain API as well
+    stats_calls = 0;
+    wav_set_stats_callback(count_stats, &stats_calls);
+    copy = readfile("output/stats.wav");
+    assert(strcmp(stats_func, "wav_read_file") == 0);
+    writefile(copy, "output/stats.wav", TYPE_INT16);
+    assert(strcmp(stats_func, "wav_write_file") == 0);
+
+    // ... under the name of the function that was called
+    result = wav_write_file_stats(&copy, "output/stats.wav", &stats);
+    assert(result == ERROR_OK && strcmp(stats_func, "wav_write_file_stats") == 0);
+    wav_destroy(&copy);
+    result = wav_read_file_stats(&copy, "output/stats.wav", &stats);
+    assert(result == ERROR_OK && strcmp(stats_func, "wav_read_file_stats") == 0);
+    wav_set_stats_callback(NULL, NULL);
+    assert(stats_calls == 4);
+
+    wav_destroy(&copy);
+    wav_destroy(&wave);
+    TEST_DONE;
+}
+
+static double sineError(const wavdata_t *wave, double freq, double amp, size_t skip)
+{
+    size_t i;
+    double e = 0;
+    assert(wave->size > skip * 2);
+
+    // the edges are blurred by the filter
+    for (i = skip; i < wave->size - skip; i++) {
+        double expected = sin(2 * M_PI * freq * i / wave->samplerate) * amp;
+        double d = fabs(wave->data[i] - expected);
+        if (d > e) e = d;
+    }
+    return e;
+}
+
+// level (dB re amp) of one frequency in a resampled sine, Hann-windowed
+static double toneLevel(unsigned from, unsigned to, double freq, double amp, double probe)
+{
+    size_t i, n = from, m;
+    double *in, *out, w, re = 0, im = 0, sum = 0;
+    wavresampler_t rs;
+    waverror_t result;
+
+    result = wav_resampler_create(&rs, from, to, 1);
+    assert(result == ERROR_OK);
+    in = (double *)malloc(n * sizeof(double));
+    out = (double *)malloc((wav_resampler_max_output(&rs, n) +
+                            wav_resampler_max_output(&rs, rs.taps)) * sizeof(double));
+    assert(in != NULL && out != NULL);
+    for (i = 0; i < n; i++) { in[i] = sin(2 * M_PI * freq * i / from) * amp; }
+    m = wav_resampler_process(&rs, in, n, out);
+    m += wav_resampler_flush(&rs, out + m);
+    wav_resampler_destroy(&rs);
+
+    // the edges are blurred by the filter
+    n = m / 2;
+    for (i = 0; i < n; i++) {
+        w = 0.5 - 0.5 * cos(2 * M_PI * i / (n - 1));
+        re += w * out[m / 4 + i] * cos(2 * M_PI * probe * i / to);
+        im += w * out[m / 4 + i] * sin(2 * M_PI * probe * i / to);
+        sum += w;
+    }
+    free(in);
+    free(out);
+    return 20 * log10(2 * sqrt(re * re + im * im) / sum / amp);
+}
+
+void test_resample()
+{
+    int i;
+    wavdata_t wave, resampled;
+    waverror_t result;
+    double e;
+    TEST_START;
+
+    result = wav_create(&wave, 44100/*Hz*/, 1/*ch*/, 44100/*frames*/);
+    assert(result == ERROR_OK);
+    for (i = 0; i < wave.size; i++) {
+        wave.data[i] = sin(2 * M_PI * 1000 * i / 44100.0) * 0.5;
+    }
+    wave.type = TYPE_FLOAT;
+
+    // before encode
+    result = wav_write_file_resampled(&wave, "output/resample_48000.wav", 48000);
+    printf("write:\toutput/resample_48000.wav: "); show_result(result);
+    assert(result == ERROR_OK);
+    resampled = readfile("output/resample_48000.wav");
+    assert(resampled.samplerate == 48000);
+    assert(resampled.size == 48000);
+    e = sineError(&resampled, 1000, 0.5, 100);
+    printf("verify:\t44100 -> 48000: %s (max diff = %1.12lf)\n", (e < 1e-3) ? "OK" : "NG", e);
+    assert(e < 1e-3);
+    wav_destroy(&resampled);
+
+    // after decode
+    result = wav_write_file(&wave, "output/resample_44100.wav");
+    assert(result == ERROR_OK);
+    result = wav_read_file_resampled(&resampled, "output/resample_44100.wav", 32000);
+    printf("read:\toutput/resample_44100.wav -> 32000: "); show_result(result);
+    assert(result == ERROR_OK);
+    assert(resampled.samplerate == 32000);
+    assert(resampled.size == 32000);
+    e = sineError(&resampled, 1000, 0.5, 100);
+    printf("verify:\t44100 -> 32000: %s (max diff = %1.12lf)\n", (e < 1e-3) ? "OK" : "NG", e);
+    assert(e < 1e-3);
+    wav_destroy(&resampled);
+
+    // flat passband up to 20 kHz; what would alias or image is removed
+    {
+        static const struct { unsigned from, to; double freq, probe, min, max; } tones[] = {
+            { 48000, 44100, 20000, 20000,  -0.1, +0.1 },
+            { 44100, 48000, 20000, 20000,  -0.1, +0.1 },
+            { 48000, 44100,  1000,  1000,  -0.1, +0.1 },
+            { 48000, 44100, 23000, 21100, -200, -80 },  // alias
+            { 44100, 48000, 20000, 28100, -200, -80 },  // image
+            { 44100, 32000, 20000, 12000, -200, -80 },  // alias
+        };
+        for (i = 0; i < (int)(sizeof(tones) / sizeof(tones[0])); i++) {
+            e = toneLevel(tones[i].from, tones[i].to, tones[i].freq, 0.5, tones[i].probe);
+            printf("verify:\t%u -> %u, %.0f Hz at %.0f Hz: %s (%.2f dB)\n",
+                   tones[i].from, tones[i].to, tones[i].freq, tones[i].probe,
+                   (e >= tones[i].min && e <= tones[i].max) ? "OK" : "NG", e);
+            assert(e >= tones[i].min && e <= tones[i].max);
+        }
+    }
+
+    // the stats callback names the resampling entry points
+    stats_calls = 0;
+    wav_set_stats_callback(count_stats, &stats_calls);
+    result = wav_write_file_resampled(&wave, "output/resample_48000.wav", 48000);
+    assert(result == ERROR_OK && strcmp(stats_func, "wav_write_file_resampled") == 0);
+    result = wav_read_file_resampled(&resampled, "output/resample_48000.wav", 44100);
+    assert(result == ERROR_OK && strcmp(stats_func, "wav_read_file_resampled") == 0);
+    wav_set_stats_callback(NULL, NULL);
+    assert(stats_calls == 2);
+    wav_destroy(&resampled);
+
+    wav_destroy(&wave);
+    TEST_DONE;
+}
+
+void test_extensible()
+{
+    int i;
+    wavdata_t wave, copy, hand;
+    waverror_t result;
+    FILE *fp;
+    TEST_START;
+
+    // 4.0 surround: FL FR BL BR
+    result = wav_create(&wave, 48000/*Hz*/, 4/*ch*/, 4800/*frames*/);
+    assert(result == ERROR_OK);
+    for (i = 0; i < wave.size; i++) {
+        wave.data[i] = sin(i * M_PI / 180.0) * 0.5;
+    }
+    // a mask must name every channel
+    result = wav_set_channelmask(&wave, 0x3);
+    assert(result == ERROR_BAD_DATA);
+
+    result = wav_set_channelmask(&wave, 0x33);
+    assert(result == ERROR_OK);
+    writefiles(wave, "output/quad");
+    verifyfiles("output/quad", wave.size, wave.data, ERROR_THRESHOLD);
+
+    for (i = (int)TYPE_UINT8; i <= (int)TYPE_DOUBLE; i++) {
+        char filename[120];
+        sprintf(filename, "output/quad_%d.wav", i);
+        copy = readfile(filename);
+        assert(copy.channels == 4);
+        assert(copy.channelmask == 0x33);
+        assert(copy.type == (wavtype_t)i);
+        wav_destroy(&copy);
+    }
+
+    // float64 is loaded bit-exact
+    copy = readfile("output/quad_6.wav");
+    assert(memcmp(copy.data, wave.data, wave.size * sizeof(double)) == 0);
+
+    // a reused struct doesn't carry the layout over
+    wav_destroy(&copy);
+    assert(copy.channelmask == 0 && copy.type == TYPE_UNKNOWN);
+
+    // a struct filled field by field, with garbage where the mask lives,
+    // is written as plain stereo PCM
+    hand.samplerate = 48000;
+    hand.channels = 2;
+    hand.size = 2 * 100;
+    hand.data = wave.data;
+    hand.type = TYPE_INT16;
+    hand.channelmask = 0xdeadbeef;
+    hand.channelmask_tag = 0x12345678;
+    writefile(hand, "output/hand.wav", TYPE_INT16);
+    fp = fopen("output/hand.wav", "rb");
+    assert(fp != NULL);
+    fseek(fp, 0, SEEK_END);
+    assert(ftell(fp) == 44 + 2 * 100 * 2);
+    fclose(fp);
+    copy = readfile("output/hand.wav");
+    assert(copy.channels == 2 && copy.channelmask == 0);
+    wav_destroy(&copy);
+
+    wav_destroy(&wave);
+    TEST_DONE;
+}
+
+// whether the filesystem under output/ takes O_DIRECT writes
+static int direct_supported()
+{
+#if defined(__linux__) && defined(O_DIRECT)
+    int fd, ok;
+    void *block;
+
+    if (posix_memalign(&block, 4096, 4096) != 0) { return 0; }
+    memset(block, 0, 4096);
+    fd = open("output/direct_probe", O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+    ok = (fd >= 0 && pwrite(fd, block, 4096, 0) == 4096);
+    if (fd >= 0) { close(fd); }
+    free(block);
+    return ok;
+#else
+    return 0;
+#endif
+}
+
+void test_write_direct()
+{
+    int i;
+    wavdata_t wave, copy, direct, big;
+    waverror_t result;
+    FILE *fp;
+    long filesize;
+    TEST_START;
+
+    // an odd number of 3-byte samples leaves a partial last block
+    result = wav_create(&wave, 44100/*Hz*/, 2/*ch*/, 300001/*frames*/);
+    assert(result == ERROR_OK);
+    for (i = 0; i < wave.size; i++) {
+        wave.data[i] = sin(i * M_PI / 180.0) * 0.5;
+    }
+    wave.type = TYPE_INT24;
+
+    result = wav_write_file_direct(&wave, "output/direct.wav");
+    printf("write:\toutput/direct.wav: "); show_result(result);
+    assert(result == ERROR_OK);
+
+    fp = fopen("output/direct.wav", "rb");
+    assert(fp != NULL);
+    fseek(fp, 0, SEEK_END);
+    filesize = ftell(fp);
+    fclose(fp);
+    printf("verify:\toutput/direct.wav: %ld bytes\n", filesize);
+    if (direct_supported()) {
+        // one header block, then the samples without the last block's padding
+        assert(filesize == 4096 + (long)wave.size * 3);
+    } else {
+        printf("verify:\tO_DIRECT refused by the filesystem, layout check skipped\n");
+    }
+
+    // the 32-bit RIFF size can't describe more than 4 GiB of samples;
+    // the data is rejected before any sample is touched
+    big = wave;
+    big.size = 0x60000000;
+    result = wav_write_file(&big, "output/too_large.wav");
+    assert(result == ERROR_BAD_DATA);
+    result = wav_write_file_direct(&big, "output/too_large.wav");
+    assert(result == ERROR_BAD_DATA);
+
+    writefile(wave, "output/direct_ref.wav", TYPE_INT24);
+    verifyfile("output/direct.wav", wave.size, wave.data, ERROR_THRESHOLD);
+
+    // same samples as the buffered writer
+    copy = readfile("output/direct_ref.wav");
+    direct = readfile("output/direct.wav");
+    assert(copy.size == direct.size);
+    assert(memcmp(copy.data, direct.data, direct.size * sizeof(double)) == 0);
+
+    wav_destroy(&direct);
+    wav_destroy(&copy);
+    wav_destroy(&wave);
+    TEST_DONE;
+}
+
+void test_raw()
+{
+    int i;
+    wavdata_t wave, copy, direct;
+    wavraw_t raw;
+    waverror_t result;
+    TEST_START;
+
+    result = wav_create(&wave, 44100/*Hz*/, 6/*ch*/, 1000/*frames*/);
+    assert(result == ERROR_OK);
+    for (i = 0; i < wave.size; i++) {
+        wave.data[i] = sin(i * M_PI / 180.0) * 0.5;
+    }
+    result = wav_set_channelmask(&wave, 0x3F);
+    assert(result == ERROR_OK);
+    writefile(wave, "output/raw.wav", TYPE_INT24);
+
+    // the data chunk comes back untouched, and goes out the same way
+    result = wav_read_file_raw(&raw, "output/raw.wav");
+    assert(result == ERROR_OK);
+    assert(raw.samplerate == 44100 && raw.channels == 6 && raw.size == wave.size);
+    assert(raw.type == TYPE_INT24 && raw.channelmask == 0x3F);
+    printf("raw:\t%d samples, %d bytes\n", (int)raw.size, (int)raw.size * 3);
+
+    result = wav_write_file_raw(&raw, "output/raw_copy.wav");
+    assert(result == ERROR_OK);
+    verifyfile("output/raw_copy.wav", wave.size, wave.data, ERROR_THRESHOLD);
+
+    copy = readfile("output/raw.wav");
+    direct = readfile("output/raw_copy.wav");
+    assert(direct.channels == 6 && direct.channelmask == 0x3F);
+    assert(copy.size == direct.size);
+    assert(memcmp(copy.data, direct.data, direct.size * sizeof(double)) == 0);
+
+    // a mask that doesn't fit the channels is refused as by wav_write_file
+    raw.channelmask = 0x3;
+    result = wav_write_file_raw(&raw, "output/raw_bad.wav");
+    assert(result == ERROR_BAD_DATA);
+
+    wav_raw_destroy(&raw);
+    assert(raw.bytes == NULL && raw.size == 0 && raw.type == TYPE_UNKNOWN);
+
+    result = wav_read_file_raw(&raw, "output/none.wav");
+    assert(result == ERROR_UNABLE_TO_OPEN && raw.bytes == NULL);
+
+    wav_destroy(&direct);
+    wav_destroy(&copy);
+    wav_destroy(&wave);
+    TEST_DONE;
+}
+
 // entry
 int main(int argc, char **argv)
 {
     init_error_messages();
     test_write_sine();
     test_read_write_verify();
+    test_follow();
+    test_stats();
+    test_resample();
+    test_extensible();
+    test_write_direct();
+    test_raw();
 
     return 0;
 }
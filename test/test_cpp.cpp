@@ -0,0 +1,335 @@
+/*
+    miniwav : A quick & dirty C library for reading/writing WAV audio file.
+    Copyright (C) 2017 mogesystem
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+       claim that you wrote the original software. If you use this software
+       in a product, an acknowledgment in the product documentation would be
+       appreciated but is not required.
+    2. Altered source versions must be plainly marked as such, and must not be
+       misrepresented as being the original software.
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "miniwav.hpp"
+
+// the "data" chunk of a file written by the C library
+static std::vector<std::uint8_t> readdata(const char *filename)
+{
+    std::vector<std::uint8_t> file, data;
+    std::uint8_t block[4096];
+    std::size_t n, pos = 12;
+    FILE *fp = std::fopen(filename, "rb");
+    assert(fp != nullptr);
+    while ((n = std::fread(block, 1, sizeof(block), fp)) > 0) {
+        file.insert(file.end(), block, block + n);
+    }
+    std::fclose(fp);
+
+    while (pos + 8 <= file.size()) {
+        std::size_t size = file[pos + 4] | (file[pos + 5] << 8) |
+                           (file[pos + 6] << 16) | (std::size_t(file[pos + 7]) << 24);
+        if (std::memcmp(&file[pos], "data", 4) == 0) {
+            assert(pos + 8 + size <= file.size());
+            data.assign(file.begin() + pos + 8, file.begin() + pos + 8 + size);
+            return data;
+        }
+        pos += 8 + size + (size & 1);
+    }
+    assert(!"no data chunk");
+    return data;
+}
+
+static miniwav::buffer makesine(std::size_t frames)
+{
+    miniwav::buffer wave;
+    waverror_t result = wave.create(44100/*Hz*/, 2/*ch*/, frames);
+    assert(result == ERROR_OK);
+    for (std::size_t i = 0; i < wave.frames(); i++) {
+        auto f = wave.frame<2>(i);
+        f[0] = std::sin(i * M_PI / 180.0) * 0.5;
+        f[1] = std::sin(i * M_PI / 90.0) * 1.25;   // clipped on encode
+    }
+    return wave;
+}
+
+// tests
+#define TEST_START      std::printf("test %s: start\n", __func__)
+#define TEST_DONE       std::printf("test %s: done\n\n", __func__)
+
+void test_buffer_move()
+{
+    TEST_START;
+
+    miniwav::buffer a = makesine(100);
+    const double *data = a.get()->data;
+
+    miniwav::buffer b(std::move(a));
+    assert(a.empty() && a.get()->data == nullptr && a.frames() == 0);
+    assert(b.get()->data == data && b.frames() == 100 && b.channels() == 2);
+
+    miniwav::buffer c = makesine(10);
+    c = std::move(b);
+    assert(b.empty() && b.get()->data == nullptr);
+    assert(c.get()->data == data && c.frames() == 100);
+    assert(c.frame(99).size() == 2 && c.frame(99).data() == data + 198);
+
+    wavdata_t raw = c.release();
+    assert(c.empty() && raw.data == data);
+    wav_destroy(&raw);
+
+    TEST_DONE;
+}
+
+void test_follower_move()
+{
+    miniwav::buffer wave = makesine(1000), part;
+    waverror_t result;
+    TEST_START;
+
+    result = wave.write("output/cpp_follow.wav");
+    assert(result == ERROR_OK);
+
+    miniwav::follower a;
+    assert(!a.is_open());
+    result = a.open("output/cpp_follow.wav");
+    assert(result == ERROR_OK && a.is_open());
+
+    miniwav::follower b(std::move(a));
+    assert(!a.is_open() && b.is_open());
+    assert(b.samplerate() == 44100 && b.channels() == 2 && b.type() == TYPE_INT16);
+    a.close();
+
+    miniwav::follower c;
+    c = std::move(b);
+    assert(!b.is_open() && c.is_open());
+
+    result = c.read(part, 0);
+    std::printf("follow:\tread %d frames\n", (int)part.frames());
+    assert(result == ERROR_OK && part.frames() == 1000);
+    result = c.read(part, -1);
+    assert(result == ERROR_OK && part.empty() && c.finished());
+
+    c.close();
+    assert(!c.is_open());
+    TEST_DONE;
+}
+
+// raw exposes the "data" chunk exactly as the C writer stored it
+void test_raw()
+{
+    miniwav::buffer wave = makesine(3000);
+    waverror_t result;
+    TEST_START;
+
+    wave.set_type(TYPE_INT24);
+    result = wav_write_file(wave.get(), "output/cpp_raw.wav");
+    assert(result == ERROR_OK);
+
+    miniwav::raw a;
+    assert(a.empty() && a.bytes().empty());
+    result = a.read("output/cpp_raw.wav");
+    assert(result == ERROR_OK);
+    assert(a.samplerate() == 44100 && a.channels() == 2 && a.type() == TYPE_INT24);
+    assert(a.frames() == 3000 && a.bytes().size() == 3000 * 2 * 3);
+    std::vector<std::uint8_t> bytes = readdata("output/cpp_raw.wav");
+    assert(std::equal(bytes.begin(), bytes.end(), a.bytes().begin()));
+
+    miniwav::raw b(std::move(a));
+    assert(a.empty() && a.get()->bytes == nullptr && b.frames() == 3000);
+
+    result = b.write("output/cpp_raw_copy.wav");
+    assert(result == ERROR_OK);
+    assert(readdata("output/cpp_raw_copy.wav") == bytes);
+
+    // the file's own decoder over the file's bytes
+    std::vector<double> decoded(b.frames() * 2);
+    miniwav::decode<TYPE_INT24, 2>(std::as_const(b).bytes(), decoded);
+    miniwav::buffer copy;
+    result = copy.read("output/cpp_raw_copy.wav");
+    assert(result == ERROR_OK && copy.samples().size() == decoded.size());
+    assert(std::equal(decoded.begin(), decoded.end(), copy.samples().begin()));
+
+    result = a.read("output/none.wav");
+    assert(result == ERROR_UNABLE_TO_OPEN && a.empty());
+    result = a.create(8000, 1, TYPE_UNKNOWN, 10);
+    assert(result == ERROR_UNSUPPORTED && a.empty());
+
+    std::printf("raw:	%d bytes\n", (int)b.bytes().size());
+    TEST_DONE;
+}
+
+// the wrapper must produce what the C API produces
+void test_resampler_move()
+{
+    miniwav::buffer wave = makesine(4410);
+    waverror_t result;
+    TEST_START;
+
+    wavresampler_t ref;
+    result = wav_resampler_create(&ref, 44100, 48000, 2);
+    assert(result == ERROR_OK);
+    std::vector<double> expect(wav_resampler_max_output(&ref, 4410) * 2 +
+                               wav_resampler_max_output(&ref, ref.taps) * 2);
+    std::size_t n = wav_resampler_process(&ref, wave.samples().data(), 4410, expect.data());
+    n += wav_resampler_flush(&ref, expect.data() + n * 2);
+    expect.resize(n * 2);
+    wav_resampler_destroy(&ref);
+
+    miniwav::resampler a;
+    assert(!a.is_open());
+    result = a.create(44100, 48000, 2);
+    assert(result == ERROR_OK && a.is_open());
+
+    miniwav::resampler b(std::move(a));
+    assert(!a.is_open() && b.is_open() && b.samplerate() == 48000 && b.channels() == 2);
+    a.reset();
+
+    miniwav::resampler c;
+    c = std::move(b);
+    assert(!b.is_open() && c.is_open());
+
+    std::vector<double> out(c.max_output(4410) * 2 + c.max_output(c.get()->taps) * 2);
+    std::size_t frames = c.process(wave.samples(), out);
+    frames += c.flush(std::span<double>(out).subspan(frames * 2));
+    out.resize(frames * 2);
+    std::printf("resampler:	%d -> %d frames\n", 4410, (int)frames);
+    assert(out == expect);
+
+    result = c.create(44100, 0, 2);
+    assert(result != ERROR_OK && !c.is_open());
+    TEST_DONE;
+}
+
+// decode/encode/convert must agree with the C codec byte for byte, and so
+// must buffer::read/write, which go through them
+void test_codec()
+{
+    miniwav::buffer wave = makesine(5000);
+    TEST_START;
+
+    // every type through dispatch, so the tag must match the runtime type
+    for (int t = (int)TYPE_UINT8; t <= (int)TYPE_DOUBLE; t++) {
+        bool known = miniwav::dispatch((wavtype_t)t, [&](auto tag) {
+            constexpr wavtype_t Type = decltype(tag)::value;
+            using traits = miniwav::sample_traits<Type>;
+            char filename[120];
+            miniwav::buffer copy, cpp;
+            waverror_t result;
+            assert(Type == (wavtype_t)t);
+
+            std::snprintf(filename, sizeof(filename), "output/cpp_%d.wav", t);
+            wave.set_type(Type);
+            result = wav_write_file(wave.get(), filename);
+            assert(result == ERROR_OK);
+            result = wav_read_file(copy.get(), filename);
+            assert(result == ERROR_OK && copy.type() == Type);
+            std::vector<std::uint8_t> bytes = readdata(filename);
+            assert(bytes.size() == wave.samples().size() * traits::bytes);
+
+            // buffer::write == C writer, buffer::read == C reader
+            result = wave.write("output/cpp_kernel.wav");
+            assert(result == ERROR_OK && readdata("output/cpp_kernel.wav") == bytes);
+            result = cpp.read(filename);
+            assert(result == ERROR_OK && cpp.type() == Type && cpp.frames() == wave.frames());
+            assert(cpp.samplerate() == 44100 && cpp.channels() == 2);
+            assert(std::memcmp(cpp.samples().data(), copy.samples().data(),
+                               cpp.samples().size() * sizeof(double)) == 0);
+
+            // encode == C writer
+            std::vector<std::uint8_t> encoded(bytes.size());
+            std::size_t frames = miniwav::encode<Type, 2>(wave.samples(), encoded);
+            assert(frames == wave.frames());
+            assert(encoded == bytes);
+
+            // decode == C reader
+            std::vector<double> decoded(wave.samples().size());
+            frames = miniwav::decode<Type, 2>(bytes, decoded);
+            assert(frames == wave.frames());
+            assert(std::memcmp(decoded.data(), copy.samples().data(),
+                               decoded.size() * sizeof(double)) == 0);
+
+            // convert from float64 == C writer, and back == C reader
+            std::vector<std::uint8_t> doubles(wave.samples().size() * 8);
+            miniwav::encode<TYPE_DOUBLE, 2>(wave.samples(), doubles);
+            std::vector<std::uint8_t> converted(bytes.size());
+            frames = miniwav::convert<TYPE_DOUBLE, Type, 2>(doubles, converted);
+            assert(frames == wave.frames() && converted == bytes);
+
+            frames = miniwav::convert<Type, TYPE_DOUBLE, 2>(bytes, doubles);
+            assert(frames == wave.frames());
+            copy.set_type(TYPE_DOUBLE);
+            result = wav_write_file(copy.get(), "output/cpp_double.wav");
+            assert(result == ERROR_OK);
+            assert(doubles == readdata("output/cpp_double.wav"));
+
+            std::printf("codec:\t%s: OK\n", filename);
+        });
+        assert(known);
+    }
+
+    bool known = miniwav::dispatch(TYPE_UNKNOWN, [](auto) { assert(!"called"); });
+    assert(!known);
+    TEST_DONE;
+}
+
+// other channel counts take the generic kernel; the mask comes through
+void test_layouts()
+{
+    miniwav::buffer wave, cpp;
+    wavdata_t ref = wavdata_t();
+    waverror_t result;
+    TEST_START;
+
+    for (unsigned ch : { 1u, 3u, 6u }) {
+        result = wave.create(48000, ch, 700);
+        assert(result == ERROR_OK);
+        for (std::size_t i = 0; i < wave.samples().size(); i++) {
+            wave.samples()[i] = std::sin(i * 0.01) * 0.75;
+        }
+        wave.set_type(TYPE_INT16);
+        if (ch == 6) {
+            result = wave.set_channelmask(0x3F);
+            assert(result == ERROR_OK);
+        }
+
+        result = wave.write("output/cpp_layout.wav");
+        assert(result == ERROR_OK);
+        result = wav_read_file(&ref, "output/cpp_layout.wav");
+        assert(result == ERROR_OK);
+        result = cpp.read("output/cpp_layout.wav");
+        assert(result == ERROR_OK && cpp.channels() == ch && cpp.frames() == 700);
+        assert(cpp.channelmask() == ref.channelmask);
+        assert(std::memcmp(cpp.samples().data(), ref.data, ref.size * sizeof(double)) == 0);
+        wav_destroy(&ref);
+        std::printf("layout:	%u ch, mask 0x%X: OK\n", ch, cpp.channelmask());
+    }
+    TEST_DONE;
+}
+
+int main(int argc, char **argv)
+{
+    test_buffer_move();
+    test_follower_move();
+    test_raw();
+    test_resampler_move();
+    test_codec();
+    test_layouts();
+
+    return 0;
+}